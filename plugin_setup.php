@@ -26,6 +26,7 @@
         }
     }
     echo "<!-- " . $curGpio . "     " . $defaultGPIO . "  -->\n";
+    $intPins = array_merge(Array("None"=>""), $gpioPins);
 ?>
 
 <script type="text/javascript">
@@ -34,8 +35,18 @@ function OnConnectionChanged() {
     var value = $('#Connection').val();
     if (value == "USB") {
         $('#ResetPinInfo').hide();
+        $('#IntPinInfo').hide();
+        $('#I2CAddressInfo').hide();
+        $('#USBWindowInfo').show();
+        $('#USBInTransfersInfo').show();
+        $('#USBBackendInfo').show();
     } else {
         $('#ResetPinInfo').show();
+        $('#IntPinInfo').show();
+        $('#I2CAddressInfo').show();
+        $('#USBWindowInfo').hide();
+        $('#USBInTransfersInfo').hide();
+        $('#USBBackendInfo').hide();
     }
 }
 </script>
@@ -47,6 +58,16 @@ function OnConnectionChanged() {
 <p>Connection: <?php PrintSettingSelect("Connection", "Connection", 2, 0, "USB", Array("USB"=>"USB", "I2C"=>"I2C"), "fpp-vastfmt", "OnConnectionChanged"); ?></p>
 <p class="ResetPinInfo" id="ResetPinInfo">Reset GPIO: <?php PrintSettingSelect("ResetPin", "ResetPin", 2, 0, $defaultGPIO, $gpioPins, "fpp-vastfmt", ""); ?><br />
 I2C connection requires a GPIO pin to reset/enable the Si4713.</p>
+<p class="IntPinInfo" id="IntPinInfo">Interrupt GPIO: <?php PrintSettingSelect("IntPin", "IntPin", 2, 0, "", $intPins, "fpp-vastfmt", ""); ?><br />
+Optional.  If the Si4713 GPO2/INT pin is wired to a GPIO, command completion is signalled by the chip instead of waiting a fixed time.</p>
+<p class="I2CAddressInfo" id="I2CAddressInfo">I2C Address: <?php PrintSettingSelect("I2CAddress", "I2CAddress", 2, 0, "63", Array("0x63 (SEN high)"=>"63", "0x11 (SEN low)"=>"11"), "fpp-vastfmt", ""); ?><br />
+Modules sharing a bus must use different addresses.</p>
+<p class="USBBackendInfo" id="USBBackendInfo">USB driver: <?php PrintSettingSelect("USBBackend", "USBBackend", 2, 0, "libusb", Array("libusb (default)"=>"libusb", "libusb synchronous"=>"sync", "hidraw"=>"hidraw"), "fpp-vastfmt", ""); ?><br />
+Synchronous reads each reply on the plugin's own thread instead of a separate read thread, and disables the pipeline window.  hidraw uses the kernel HID driver directly, without a read thread.  Falls back to libusb if no hidraw device is found.</p>
+<p class="USBWindowInfo" id="USBWindowInfo">USB pipeline window: <?php PrintSettingSelect("USBWindow", "USBWindow", 2, 0, "1", Array("1 (default)"=>"1", "2"=>"2", "4"=>"4", "8"=>"8"), "fpp-vastfmt", ""); ?><br />
+How many RDS loads/property writes are sent to the VAST-FMT before waiting for replies.  Run "make vastbench" and ./vastbench to see what your firmware handles.</p>
+<p class="USBInTransfersInfo" id="USBInTransfersInfo">USB IN transfers: <?php PrintSettingSelect("USBInTransfers", "USBInTransfers", 2, 0, "2", Array("1"=>"1", "2 (default)"=>"2", "4"=>"4"), "fpp-vastfmt", ""); ?><br />
+How many reads are kept queued to the VAST-FMT so a reply never waits for a resubmit.</p>
 </fieldset>
 </div>
 
@@ -59,6 +80,8 @@ I2C connection requires a GPIO pin to reset/enable the Si4713.</p>
 At Start, the hardware is reset, FM settings initialized, will broadcast any audio played, and send static RDS messages (if enabled).</p>
 <p>Stop at: <?php PrintSettingSelect("Stop", "Stop", 2, 0, "Never", Array("Playlist Stop"=>"PlaylistStop", "Never (default)"=>"Never"), "fpp-vastfmt", ""); ?><br />
 At Stop, the hardware is reset. Listeners will hear static.</p>
+<p>Stop mode: <?php PrintSettingSelect("StopMode", "StopMode", 2, 0, "Close", Array("Close device (default)"=>"Close", "Standby - power down, keep device open"=>"Standby"), "fpp-vastfmt", ""); ?><br />
+Standby keeps the USB/I2C connection open and only powers the Si4713 down, so the next start is much faster.</p>
 <p>Enable Volume Change Hack for Vast-FMT 212R: <?php PrintSettingCheckbox("EnableVolumeChangeHack", "EnableVolumeChangeHack", 2, 0, "1", "0", "fpp-vastfmt", ""); ?></p>
 </fieldset>
 </div>
@@ -1,5 +1,7 @@
 #include <fpp-pch.h>
 
+#include <atomic>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -15,6 +17,7 @@
 
 #include "VASTFMT.h"
 #include "I2CSi4713.h"
+#include "Si4713Worker.h"
 
 #if defined(PLATFORM_BBB) || defined(PLATFORM_BB64)
 #include "util/BBBUtils.h"
@@ -23,6 +26,10 @@ constexpr int DEFAULT_GPIO = 3;
 constexpr int DEFAULT_GPIO = 0;
 #endif
 
+// a replugged VAST-FMT is retried with a doubling delay up to this, about
+// 3 seconds in all, while usbhid finishes probing it
+constexpr int HOTPLUG_RETRY_MAX_MS = 1600;
+
 static std::string padToNearest(std::string s, int l) {
     if (!s.empty()) {
         int n = 0;
@@ -43,19 +50,73 @@ static void padTo(std::string &s, int l) {
     }
 }
 
+// FPP command that checks its arguments on the calling thread and hands
+// them to the plugin, which queues the actual chip access
+class VastFMCommand : public Command {
+public:
+    VastFMCommand(const std::string &name, const std::string &description,
+                  const std::function<std::string(const std::vector<std::string> &)> &fn)
+        : Command(name, description), fn(fn) {}
+
+    virtual std::unique_ptr<Command::Result> run(const std::vector<std::string> &a) override {
+        if (a.size() < args.size()) {
+            return std::make_unique<Command::ErrorResult>("Not enough arguments");
+        }
+        std::string err = fn(a);
+        if (!err.empty()) {
+            return std::make_unique<Command::ErrorResult>(err);
+        }
+        return std::make_unique<Command::Result>(name + " queued");
+    }
+private:
+    std::function<std::string(const std::vector<std::string> &)> fn;
+};
+
 class FPPVastFMPlugin : public FPPPlugin {
 public:
+    enum class State {
+        Stopped,
+        Starting,
+        Ready,
+        Failed
+    };
+
     bool enabled = true;
-    bool rdsEnabled = false;
+    std::atomic<bool> rdsEnabled{false};
+    std::atomic<State> state{State::Stopped};
     FPPVastFMPlugin() : FPPPlugin("fpp-vastfmt") {
         setDefaultSettings();
+        if (settings["Connection"] != "I2C") {
+            // a replug or brown out re-enumerates the VAST-FMT, reopen it
+            // as soon as it is back instead of writing to a dead handle
+            if (!VASTFMT::watchHotplug([this](bool arrived) {
+                    worker.post([this, arrived]() {
+                        if (arrived) {
+                            deviceArrived();
+                        } else {
+                            deviceRemoved();
+                        }
+                    });
+                })) {
+                LogWarn(VB_PLUGIN, "VAST-FMT: USB hotplug not supported, a replugged transmitter needs an fppd restart\n");
+            }
+        }
+        addCommands();
         if (settings["Start"] == "FPPDStart") {
-            startVast();
+            queueStart(false);
         } else if (settings["Start"] == "RDSOnly") {
-            startVastForRDS();
+            queueStart(true);
         }
     }
     virtual ~FPPVastFMPlugin() {
+        VASTFMT::unwatchHotplug();
+        for (auto c : commands) {
+            CommandManager::INSTANCE.removeCommand(c);
+            delete c;
+        }
+        commands.clear();
+        worker.stop();
+        logStats();
         if (si4713 != nullptr) {
             //si4713->powerDown();
             delete si4713;
@@ -83,11 +144,23 @@ public:
                 pin = "P1_04";
 #endif
             }
-            si4713 = new I2CSi4713(pin);
+            si4713 = new I2CSi4713(pin, settings["IntPin"], std::stoi(settings["I2CAddress"], nullptr, 16));
         } else {
-            si4713 = new VASTFMT();
+            VASTFMT::setInputTransfers(std::stoi(settings["USBInTransfers"]));
+            VASTFMT::Backend backend = VASTFMT::Backend::LibUSB;
+            if (settings["USBBackend"] == "hidraw") {
+                backend = VASTFMT::Backend::HIDRaw;
+            } else if (settings["USBBackend"] == "sync") {
+                backend = VASTFMT::Backend::Synchronous;
+            }
+            VASTFMT *vast = new VASTFMT(backend, !hotplugReopen);
+            vast->setPipelineWindow(std::stoi(settings["USBWindow"]));
+            si4713 = vast;
         }
         if (si4713->isOk()) {
+            si4713->setPreemptCallback([this]() {
+                worker.preempt();
+            });
             si4713->enableAudioCompression(settings["AudioCompression"] == "True");
             si4713->enableAudioLimitter(settings["AudioLimitter"] == "True");
             si4713->setAudioGain(std::stoi(settings["AudioGain"]));
@@ -95,8 +168,7 @@ public:
             if (settings["Preemphasis"] == "50us") {
                 si4713->setEUPreemphasis();
             }
-            
-            si4713->Init();
+            si4713->setPTY(std::stoi(settings["Pty"]));
 
             std::string rev = si4713->getRev();
             LogInfo(VB_PLUGIN, "VAST-FMT: %s\n", rev.c_str());
@@ -115,39 +187,59 @@ public:
     void initRDS() {
         LogInfo(VB_PLUGIN, "Enabling RDS\n");
         si4713->beginRDS();
-        formatAndSendText(settings["StationText"], "", "", true);
-        formatAndSendText(settings["RDSTextText"], "", "", false);
+        sendText("", "");
     }
     
     void startVast() {
-        if (si4713 == nullptr) {
+        if (si4713 != nullptr && standby) {
+            // the device is still open, only the chip state needs restoring
+            LogInfo(VB_PLUGIN, "VAST-FMT: resuming from standby\n");
+            standby = false;
+            si4713->powerUp();
+            configureVast(false);
+        } else if (si4713 == nullptr) {
             if (initVast()) {
-                std::string freq = settings["Frequency"];
-                float f = std::stof(freq);
-                f *= 100;
-                si4713->setFrequency(f);
-
-                f = std::stoi(settings["AntCap"]);
-                si4713->setTXPower(std::stoi(settings["Power"]), f);
-                
-                si4713->setPTY(std::stoi(settings["Pty"]));
-                
-                std::string asq = si4713->getASQ();
-                LogInfo(VB_PLUGIN, "VAST-FMT: %s\n", asq.c_str());
-                
-                std::string ts = si4713->getTuneStatus();
-                LogInfo(VB_PLUGIN, "VAST-FMT: %s\n", ts.c_str());
+                configureVast(true);
+            }
+        }
+    }
+    void configureVast(bool checkConfigured) {
+        std::string freq = settings["Frequency"];
+        int f = std::lround(std::stof(freq) * 100);
+        int power = std::stoi(settings["Power"]);
+        double antCap = std::stoi(settings["AntCap"]);
+        rdsEnabled = settings["EnableRDS"] == "True";
 
-                rdsEnabled = settings["EnableRDS"] == "True";
-                if (rdsEnabled) {
-                    initRDS();
-                }
+        // after an fppd restart the transmitter may still be on air
+        // with these settings, don't glitch the audio by retuning
+        if (checkConfigured && si4713->isConfigured(f, power, antCap, rdsEnabled)) {
+            LogInfo(VB_PLUGIN, "VAST-FMT: transmitter already configured, skipping init\n");
+            // only properties whose setting changed since are written
+            si4713->Init();
+            if (rdsEnabled) {
+                initRDS();
+            }
+        } else {
+            si4713->Init();
+            si4713->setFrequency(f);
+            si4713->setTXPower(power, antCap);
+            if (rdsEnabled) {
+                initRDS();
             }
         }
+
+        // a mute survives restarts and replugs, and one left on the chip
+        // by a previous run is cleared
+        si4713->setMute(muted);
+
+        worker.post(Si4713Worker::Priority::Status, [this]() {
+            logStatus();
+        });
     }
     void startVastForRDS() {
         if (si4713 == nullptr) {
             if (initVast()) {
+                si4713->Init();
                 rdsEnabled = settings["EnableRDS"] == "True";
                 if (rdsEnabled) {
                     initRDS();
@@ -157,22 +249,222 @@ public:
             }
         }
     }
+    // Bring-up can take close to a second (reset pulse, POWER_UP, property
+    // writes) so it runs on the worker.  Text updates that arrive while
+    // starting are held and applied once the transmitter is ready.
+    void queueStart(bool rdsOnly) {
+        std::unique_lock<std::mutex> l(pendingLock);
+        state = State::Starting;
+        l.unlock();
+        worker.post([this, rdsOnly]() {
+            startedForRDS = rdsOnly;
+            if (rdsOnly) {
+                startVastForRDS();
+            } else {
+                startVast();
+            }
+            startComplete();
+        });
+    }
+    void startComplete() {
+        std::unique_lock<std::mutex> l(pendingLock);
+        state = si4713 != nullptr ? State::Ready : State::Failed;
+        bool hasPending = pendingText;
+        std::string artist = pendingArtist;
+        std::string title = pendingTitle;
+        Si4713Worker::Deadline deadline = pendingDeadline;
+        pendingText = false;
+        l.unlock();
+
+        LogInfo(VB_PLUGIN, "VAST-FMT: transmitter %s\n", state == State::Ready ? "ready" : "failed to start");
+        if (hasPending && rdsEnabled) {
+            // queued with the song's deadline, a song that ended while
+            // starting isn't put on air
+            queueText(artist, title, deadline);
+        }
+    }
+    void updateText(const std::string &artist, const std::string &title,
+                    Si4713Worker::Deadline deadline = Si4713Worker::NO_DEADLINE) {
+        std::unique_lock<std::mutex> l(pendingLock);
+        lastArtist = artist;
+        lastTitle = title;
+        lastDeadline = deadline;
+        if (state == State::Starting) {
+            pendingText = true;
+            pendingArtist = artist;
+            pendingTitle = title;
+            pendingDeadline = deadline;
+            return;
+        }
+        l.unlock();
+        if (rdsEnabled) {
+            queueText(artist, title, deadline);
+        }
+    }
+    // worker thread, from the hotplug events
+    void deviceRemoved() {
+        if (si4713 == nullptr || settings["Connection"] == "I2C") {
+            return;
+        }
+        LogWarn(VB_PLUGIN, "VAST-FMT: transmitter unplugged\n");
+        LogInfo(VB_PLUGIN, "VAST-FMT: %s\n", si4713->getStats().c_str());
+        delete si4713;
+        si4713 = nullptr;
+        standby = false;
+    }
+    void deviceArrived() {
+        // nothing wanted on air, or still talking to another VAST-FMT
+        if (state == State::Stopped || si4713 != nullptr) {
+            return;
+        }
+        LogInfo(VB_PLUGIN, "VAST-FMT: transmitter plugged in, restarting\n");
+        // same path as a start, with the text that was last on air
+        // queued as pending so startComplete() replays it
+        std::unique_lock<std::mutex> l(pendingLock);
+        state = State::Starting;
+        pendingText = true;
+        pendingArtist = lastArtist;
+        pendingTitle = lastTitle;
+        pendingDeadline = lastDeadline;
+        l.unlock();
+        // The arrival is reported before usbhid has bound, so the hidraw
+        // node may not exist yet or a libusb claim may race the probe.
+        // Retry instead of failing, and without falling back to libusb
+        // which would detach usbhid from under a hidraw setup.
+        hotplugReopen = true;
+        for (int delayMs = 100; ; delayMs *= 2) {
+            if (startedForRDS) {
+                startVastForRDS();
+            } else {
+                startVast();
+            }
+            if (si4713 != nullptr || delayMs > HOTPLUG_RETRY_MAX_MS) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+        }
+        hotplugReopen = false;
+        startComplete();
+    }
+    // Tune, power and mute are Control jobs so they run ahead of queued RDS
+    // updates and in between the batches of a RadioText load.  They only
+    // touch the chip and the settings they change, never create or delete
+    // the device, as they can run from inside another job.
+    void addCommands() {
+        VastFMCommand *c = new VastFMCommand("VAST-FMT Set Frequency", "Retune the FM transmitter",
+            [this](const std::vector<std::string> &args) {
+                float mhz = 0;
+                try {
+                    mhz = std::stof(args[0]);
+                } catch (...) {
+                }
+                if (mhz < 76.0f || mhz > 108.0f) {
+                    return std::string("Frequency must be 76.00-108.00 MHz");
+                }
+                std::string freq = args[0];
+                worker.post(Si4713Worker::Priority::Control, [this, freq]() {
+                    settings["Frequency"] = freq;
+                    if (si4713 != nullptr && !standby) {
+                        si4713->setFrequency(std::lround(std::stof(freq) * 100));
+                    }
+                });
+                return std::string();
+            });
+        c->args.push_back(CommandArg("Frequency", "string", "Frequency (MHz)").setDefaultValue(settings["Frequency"]));
+        commands.push_back(c);
+
+        c = new VastFMCommand("VAST-FMT Set Power", "Change the FM transmitter output power",
+            [this](const std::vector<std::string> &args) {
+                int power = 0;
+                try {
+                    power = std::stoi(args[0]);
+                } catch (...) {
+                }
+                if (power < 88 || power > 120) {
+                    return std::string("Power must be 88-120 dBuV");
+                }
+                worker.post(Si4713Worker::Priority::Control, [this, power]() {
+                    settings["Power"] = std::to_string(power);
+                    if (si4713 != nullptr && !standby) {
+                        si4713->setTXPower(power, std::stoi(settings["AntCap"]));
+                    }
+                });
+                return std::string();
+            });
+        c->args.push_back(CommandArg("Power", "int", "Power (dBuV)").setRange(88, 120).setDefaultValue(settings["Power"]));
+        commands.push_back(c);
+
+        c = new VastFMCommand("VAST-FMT Mute", "Mute or unmute the FM transmitter audio",
+            [this](const std::vector<std::string> &args) {
+                bool mute = args[0] == "true" || args[0] == "1";
+                worker.post(Si4713Worker::Priority::Control, [this, mute]() {
+                    muted = mute;
+                    if (si4713 != nullptr && !standby) {
+                        si4713->setMute(mute);
+                    }
+                });
+                return std::string();
+            });
+        c->args.push_back(CommandArg("Mute", "bool", "Mute").setDefaultValue("true"));
+        commands.push_back(c);
+
+        c = new VastFMCommand("VAST-FMT Log Statistics", "Log the FM transmitter queue and bus statistics",
+            [this](const std::vector<std::string> &args) {
+                worker.post(Si4713Worker::Priority::Status, [this]() {
+                    logStats();
+                });
+                return std::string();
+            });
+        commands.push_back(c);
+
+        for (auto cmd : commands) {
+            CommandManager::INSTANCE.addCommand(cmd);
+        }
+    }
+
+    void logStatus() {
+        if (si4713 == nullptr) {
+            return;
+        }
+        std::string asq = si4713->getASQ();
+        LogInfo(VB_PLUGIN, "VAST-FMT: %s\n", asq.c_str());
+        
+        std::string ts = si4713->getTuneStatus();
+        LogInfo(VB_PLUGIN, "VAST-FMT: %s\n", ts.c_str());
+    }
+    // worker thread, or after the worker has stopped
+    void logStats() {
+        LogInfo(VB_PLUGIN, "VAST-FMT: %s\n", worker.getStats().c_str());
+        if (si4713 != nullptr) {
+            LogInfo(VB_PLUGIN, "VAST-FMT: %s\n", si4713->getStats().c_str());
+        }
+    }
+    // state is set to Stopped by the caller when posting, a start posted
+    // after this stop has already moved it on to Starting
     void stopVast() {
+        logStats();
+        if (state != State::Starting) {
+            rdsEnabled = false;
+        }
         if (si4713 != nullptr) {
-            //si4713->powerDown();
-            delete si4713;
-            si4713 = nullptr;
+            if (settings["StopMode"] == "Standby") {
+                // keep the USB handle/I2C bus open so the next start
+                // doesn't have to enumerate and reset again
+                si4713->powerDown();
+                standby = true;
+            } else {
+                delete si4713;
+                si4713 = nullptr;
+            }
         }
     }
     
-    void formatAndSendText(const std::string &text, const std::string &artist, const std::string &title, bool station) {
+    std::string formatText(const std::string &text, const std::string &artist, const std::string &title,
+                           int &artistIdx, int &titleIdx) {
         std::string output;
         
-        int artistIdx = -1;
-        int titleIdx = -1;
-
-        if (!si4713)
-            return;
+        artistIdx = -1;
+        titleIdx = -1;
 
         for (int x = 0; x < text.length(); x++) {
             if (text[x] == '[') {
@@ -202,47 +494,108 @@ public:
                 output += text[x];
             }
         }
-        if (station) {
-            LogDebug(VB_PLUGIN, "Setting RDS Station text to \"%s\"\n", output.c_str());
-            std::vector<std::string> fragments;
-            while (output.size()) {
-                if (output.size() <= 8) {
-                    padTo(output, 8);
-                    fragments.push_back(output);
-                    output.clear();
-                } else {
-                    std::string lft = output.substr(0, 8);
-                    padTo(lft, 8);
-                    output = output.substr(8);
-                    fragments.push_back(lft);
-                }
-            }
-            if (fragments.empty()) {
-                std::string m = "        ";
-                fragments.push_back(m);
+        return output;
+    }
+    std::vector<std::string> formatStation(const std::string &artist, const std::string &title) {
+        int artistIdx, titleIdx;
+        std::string output = formatText(settings["StationText"], artist, title, artistIdx, titleIdx);
+        LogDebug(VB_PLUGIN, "Setting RDS Station text to \"%s\"\n", output.c_str());
+        std::vector<std::string> fragments;
+        while (output.size()) {
+            if (output.size() <= 8) {
+                padTo(output, 8);
+                fragments.push_back(output);
+                output.clear();
+            } else {
+                std::string lft = output.substr(0, 8);
+                padTo(lft, 8);
+                output = output.substr(8);
+                fragments.push_back(lft);
             }
-            si4713->setRDSStation(fragments);
-        } else {
-            LogDebug(VB_PLUGIN, "Setting RDS text to \"%s\"\n", output.c_str());
-            si4713->setRDSBuffer(output, artistIdx, artist.length(), titleIdx, title.length());
         }
+        if (fragments.empty()) {
+            std::string m = "        ";
+            fragments.push_back(m);
+        }
+        return fragments;
+    }
+
+    // send the station and RDS text immediately, worker thread only
+    void sendText(const std::string &artist, const std::string &title) {
+        if (!si4713) {
+            return;
+        }
+        si4713->setRDSStation(formatStation(artist, title));
+
+        int artistIdx, titleIdx;
+        std::string output = formatText(settings["RDSTextText"], artist, title, artistIdx, titleIdx);
+        LogDebug(VB_PLUGIN, "Setting RDS text to \"%s\"\n", output.c_str());
+        si4713->setRDSBuffer(output, artistIdx, artist.length(), titleIdx, title.length());
+    }
+    // format on the calling thread and queue each part as its own
+    // update so a newer song replaces anything not yet sent
+    void queueText(const std::string &artist, const std::string &title,
+                   Si4713Worker::Deadline deadline = Si4713Worker::NO_DEADLINE) {
+        std::vector<std::string> station = formatStation(artist, title);
+
+        int artistIdx, titleIdx;
+        std::string output = formatText(settings["RDSTextText"], artist, title, artistIdx, titleIdx);
+        LogDebug(VB_PLUGIN, "Queuing RDS text \"%s\"\n", output.c_str());
+        int artistLen = artist.length();
+        int titleLen = title.length();
+
+        worker.post(Si4713Worker::Kind::PS, [this, station]() {
+            if (si4713) {
+                si4713->setRDSStation(station);
+            }
+        }, deadline);
+        worker.post(Si4713Worker::Kind::RT, [this, output]() {
+            if (si4713) {
+                si4713->setRDSText(output);
+            }
+        }, deadline);
+        worker.post(Si4713Worker::Kind::RTPlus, [this, artistIdx, artistLen, titleIdx, titleLen]() {
+            if (si4713) {
+                si4713->setRTPlus(artistIdx, artistLen, titleIdx, titleLen);
+            }
+        }, deadline);
+        worker.post(Si4713Worker::Kind::CT, [this]() {
+            if (si4713) {
+                si4713->sendTimestamp();
+            }
+        }, deadline);
     }
     
 
+    // All Si4713 access happens on the worker thread, the FPP callbacks
+    // below only queue the work so fppd is never blocked on USB/I2C
     virtual void playlistCallback(const Json::Value &playlist, const std::string &action, const std::string &section, int item) {
-        if (action == "stop" && rdsEnabled) {
-            formatAndSendText(settings["StationText"], "", "", true);
-            formatAndSendText(settings["RDSTextText"], "", "", false);
+        if (action == "stop") {
+            updateText("", "");
+            // once per playlist whatever the stop mode, stopVast logs
+            // them too when it runs
+            if (settings["Stop"] != "PlaylistStop") {
+                worker.post(Si4713Worker::Priority::Status, [this]() {
+                    logStats();
+                });
+            }
         }
         if (settings["Start"] == "PlaylistStart" && action == "start") {
-            startVast();
+            queueStart(false);
         } else if (settings["Stop"] == "PlaylistStop" && action == "stop") {
-            stopVast();
+            std::unique_lock<std::mutex> l(pendingLock);
+            state = State::Stopped;
+            l.unlock();
+            worker.post([this]() {
+                stopVast();
+            });
         }
-        
     }
     virtual void mediaCallback(const Json::Value &playlist, const MediaDetails &mediaDetails) {
-        if (!rdsEnabled) {
+        // rdsEnabled is only set once the start job has configured the
+        // chip, until then go by the setting it will be set from
+        bool rds = state == State::Starting ? settings["EnableRDS"] == "True" : rdsEnabled.load();
+        if (!rds) {
             return;
         }
         std::string title = mediaDetails.title;
@@ -272,8 +625,12 @@ public:
             artist = "";
         }
         
-        formatAndSendText(settings["StationText"], artist, title, true);
-        formatAndSendText(settings["RDSTextText"], artist, title, false);
+        // no point sending the text for a song that has already finished
+        Si4713Worker::Deadline deadline = Si4713Worker::NO_DEADLINE;
+        if (length > 0) {
+            deadline = std::chrono::steady_clock::now() + std::chrono::seconds(length);
+        }
+        updateText(artist, title, deadline);
     }
     
     
@@ -290,11 +647,17 @@ public:
         
         setIfNotFound("Connection", "USB");
         setIfNotFound("EnableVolumeChangeHack", "0");
+        setIfNotFound("StopMode", "Close");
 #ifdef PLATFORM_BBB
         setIfNotFound("ResetPin", "14");
 #else
         setIfNotFound("ResetPin", "4");
 #endif
+        setIfNotFound("IntPin", "", true);
+        setIfNotFound("I2CAddress", "63");
+        setIfNotFound("USBWindow", "1");
+        setIfNotFound("USBInTransfers", "2");
+        setIfNotFound("USBBackend", "libusb");
         setIfNotFound("AudioCompression", "True");
         setIfNotFound("AudioLimitter", "True");
         setIfNotFound("AudioGain", "5");
@@ -309,7 +672,24 @@ public:
         LogDebug(VB_PLUGIN, "Setting \"%s\": \"%s\"\n", s.c_str(), settings[s].c_str());
     }
     
+    // only touched from the worker thread once the plugin is constructed
     Si4713 *si4713 = nullptr;
+    bool standby = false;
+    bool startedForRDS = false;
+    bool hotplugReopen = false;
+    bool muted = false;
+    Si4713Worker worker;
+    std::vector<Command *> commands;
+
+    std::mutex pendingLock;
+    bool pendingText = false;
+    std::string pendingArtist;
+    std::string pendingTitle;
+    Si4713Worker::Deadline pendingDeadline = Si4713Worker::NO_DEADLINE;
+    // desired text, replayed when the transmitter is plugged back in
+    std::string lastArtist;
+    std::string lastTitle;
+    Si4713Worker::Deadline lastDeadline = Si4713Worker::NO_DEADLINE;
 };
 
 
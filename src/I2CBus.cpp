@@ -0,0 +1,123 @@
+#include <fpp-pch.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#if defined(__linux__)
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#endif
+
+#include "log.h"
+
+#include "I2CBus.h"
+
+std::mutex I2CBus::busesLock;
+std::map<int, std::weak_ptr<I2CBus>> I2CBus::buses;
+
+std::shared_ptr<I2CBus> I2CBus::getBus(int bus) {
+    std::unique_lock<std::mutex> l(busesLock);
+    std::shared_ptr<I2CBus> b = buses[bus].lock();
+    if (!b) {
+        b = std::shared_ptr<I2CBus>(new I2CBus(bus));
+        buses[bus] = b;
+    }
+    return b;
+}
+
+I2CBus::I2CBus(int b) : bus(b) {
+    openDevice();
+}
+void I2CBus::openDevice() {
+#if defined(__linux__)
+    std::string dev = "/dev/i2c-" + std::to_string(bus);
+    fd = open(dev.c_str(), O_RDWR);
+    if (fd < 0) {
+        LogErr(VB_PLUGIN, "Could not open %s: %s\n", dev.c_str(), strerror(errno));
+        return;
+    }
+    // bound a stuck transfer to 50ms instead of the adapter default
+    ioctl(fd, I2C_TIMEOUT, 5);
+#endif
+}
+I2CBus::~I2CBus() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+int I2CBus::transfer(uint8_t address, const uint8_t *wr, int wrLen, uint8_t *rd, int rdLen) {
+#if defined(__linux__)
+    std::unique_lock<std::mutex> l(lock, std::try_to_lock);
+    if (!l.owns_lock()) {
+        l.lock();
+        contended++;
+    }
+    transactions++;
+    struct i2c_msg msgs[2];
+    int n = 0;
+    if (wrLen) {
+        msgs[n].addr = address;
+        msgs[n].flags = 0;
+        msgs[n].len = wrLen;
+        msgs[n].buf = (uint8_t*)wr;
+        n++;
+    }
+    if (rdLen) {
+        msgs[n].addr = address;
+        msgs[n].flags = I2C_M_RD;
+        msgs[n].len = rdLen;
+        msgs[n].buf = rd;
+        n++;
+    }
+    struct i2c_rdwr_ioctl_data data;
+    data.msgs = msgs;
+    data.nmsgs = n;
+    if (ioctl(fd, I2C_RDWR, &data) < 0) {
+        errors++;
+        LogExcess(VB_PLUGIN, "I2C_RDWR to %X failed: %s\n", address, strerror(errno));
+        return -1;
+    }
+    return rdLen ? rdLen : wrLen;
+#else
+    return -1;
+#endif
+}
+
+// Userspace can't bit-bang SCL while the pins are muxed to the I2C
+// controller.  Reopening the adapter and clocking a one byte read
+// through it gives the controller (and its driver's own SCL recovery) a
+// chance to release a slave that is holding SDA low.
+bool I2CBus::clear(uint8_t address, uint8_t &status) {
+#if defined(__linux__)
+    std::unique_lock<std::mutex> l(lock);
+    clears++;
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    openDevice();
+    if (fd < 0) {
+        return false;
+    }
+    status = 0;
+    struct i2c_msg msg;
+    msg.addr = address;
+    msg.flags = I2C_M_RD;
+    msg.len = 1;
+    msg.buf = &status;
+    struct i2c_rdwr_ioctl_data data;
+    data.msgs = &msg;
+    data.nmsgs = 1;
+    return ioctl(fd, I2C_RDWR, &data) >= 0;
+#else
+    return false;
+#endif
+}
+
+std::string I2CBus::getStats() {
+    std::unique_lock<std::mutex> l(lock);
+    return "I2C bus " + std::to_string(bus) + " transactions/contended/errors/clears: " + std::to_string(transactions)
+        + "/" + std::to_string(contended) + "/" + std::to_string(errors) + "/" + std::to_string(clears);
+}
@@ -0,0 +1,52 @@
+#ifndef __I2CBUS__
+#define __I2CBUS__
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Raw /dev/i2c-N access through I2C_RDWR so a command write and its
+// response read go out as a single transaction with a repeated start
+// instead of separate write/read syscalls.
+//
+// There is one instance per bus shared by every Si4713 on it.  Only a
+// single transaction holds the bus at a time, never a wait for CTS, so
+// while one chip is busy the other chips' workers can use the bus.
+class I2CBus {
+public:
+    static std::shared_ptr<I2CBus> getBus(int bus);
+    virtual ~I2CBus();
+
+    bool isOk() const { return fd >= 0; }
+
+    // Either side may be empty.  Returns the number of bytes read (or
+    // written if there is nothing to read), -1 on error.
+    int transfer(uint8_t address, const uint8_t *wr, int wrLen, uint8_t *rd, int rdLen);
+
+    // Bus clear after a failed transfer, true if the address answers
+    // afterwards with the byte it returned in status
+    bool clear(uint8_t address, uint8_t &status);
+
+    std::string getStats();
+
+private:
+    I2CBus(int bus);
+    void openDevice();
+
+    int bus;
+    int fd = -1;
+
+    std::mutex lock;
+    uint64_t transactions = 0;
+    uint64_t contended = 0;
+    uint64_t errors = 0;
+    uint64_t clears = 0;
+
+    static std::mutex busesLock;
+    static std::map<int, std::weak_ptr<I2CBus>> buses;
+};
+
+#endif
@@ -1,8 +1,11 @@
 #include <fpp-pch.h>
 
+#include <poll.h>
+#include <unistd.h>
+
 #include "I2CSi4713.h"
+#include "I2CBus.h"
 
-#include "util/I2CUtils.h"
 #include "util/GPIOUtils.h"
 
 // Commands
@@ -26,49 +29,217 @@
 #define SI4710_CMD_GPO_SET          0x81
 
 
+#define SI4713_PROP_GPO_IEN       0x0001
 #define SI4713_PROP_REFCLK_FREQ   0x0201
 
+// POWER_UP arg1
+#define SI4710_POWER_UP_IN_GPO2OEN  0x40
+// GPO_IEN
+#define SI4713_GPO_IEN_CTSIEN       0x0080
+#define SI4713_GPO_IEN_STCIEN       0x0001
+
+// Reset timing from the datasheet: RST low for at least 100us and a
+// short settle after it rises before the first command.  POWER_UP
+// itself is confirmed by CTS once the crystal is running.
+#define SI4713_RESET_LOW_US       100
+#define SI4713_RESET_SETTLE_US    1000
+#define SI4713_POWER_UP_TIMEOUT   500
+// a tune, power or antenna measurement sets STC once it has settled
+#define SI4713_STC_TIMEOUT_MS     300
+#define SI4713_STC_POLL_US        3000
+
+// how long a responsive chip may stay busy during recovery, and how long
+// to wait before trying again after the whole ladder failed
+#define SI4713_RECOVERY_STATUS_MS  10
+#define SI4713_RECOVERY_BACKOFF_MS 5000
+
+static const char *recoveryNames[] = {
+    "bus clear",
+    "status",
+    "soft re-init",
+    "GPIO reset",
+    "failed"
+};
+
 #if defined(PLATFORM_BBB) || defined(PLATFORM_BB64)
 #define I2CBUS 2
 #else
 #define I2CBUS 1
 #endif
 
-I2CSi4713::I2CSi4713(const std::string &gpioPin) {
+I2CSi4713::I2CSi4713(const std::string &gpioPin, const std::string &intPinName, uint8_t addr) : address(addr) {
     resetPin = PinCapabilities::getPinByName(gpioPin).ptr();
     resetPin->configPin("gpio", "out");
     resetPin->setValue(1);
-    std::this_thread::sleep_for(std::chrono::microseconds(200000));
-    resetPin->setValue(0);
-    std::this_thread::sleep_for(std::chrono::microseconds(200000));
-    resetPin->setValue(1);
-    std::this_thread::sleep_for(std::chrono::microseconds(300000));
-    i2c = new I2CUtils(I2CBUS, 0x63);
-    if (i2c->isOk()) {
-        sendSi4711Command(SI4710_CMD_POWER_UP, {0x12, 0x50});
-        std::this_thread::sleep_for(std::chrono::microseconds(200000));
-        setProperty(SI4713_PROP_REFCLK_FREQ, 32768);
-    } else {
-        delete i2c;
+    // the pin may have only just released the chip from reset
+    std::this_thread::sleep_for(std::chrono::microseconds(SI4713_RESET_SETTLE_US));
+
+    if (!intPinName.empty()) {
+        intPin = PinCapabilities::getPinByName(intPinName).ptr();
+        if (intPin) {
+            intPin->configPin("gpio", false);
+            // INT is active low
+            intFd = intPin->requestEventFile(false, true);
+        }
+        if (intFd < 0) {
+            LogWarn(VB_PLUGIN, "Could not get edge events for Si4713 interrupt pin %s, polling instead\n", intPinName.c_str());
+        }
+    }
+
+    // If fppd restarted while the chip stayed powered it may still be
+    // tuned and configured, don't reset it so the plugin can check that
+    i2c = I2CBus::getBus(I2CBUS);
+    if (!i2c->isOk()) {
         i2c = nullptr;
+        return;
+    }
+    // A chip still in reset or powered down doesn't answer the probe,
+    // that's expected and must not run the recovery ladder or arm its
+    // backoff, the reset below handles it
+    recovering = true;
+    bool poweredUp = isPoweredUp();
+    recovering = false;
+    if (poweredUp) {
+        LogInfo(VB_PLUGIN, "Si4713 at %X already powered up, skipping reset\n", address);
+        enableInterrupts();
+        return;
     }
+    startReset();
 }
 I2CSi4713::~I2CSi4713() {
     if (i2c) {
         //sendSi4711Command(SI4710_CMD_POWER_DOWN, {});
-        delete i2c;
+    }
+    releaseInterruptPin();
+}
+// The event fd belongs to the GPIO line, releasing the line closes it and
+// frees the pin for anything else
+void I2CSi4713::releaseInterruptPin() {
+    if (intFd >= 0) {
+        intPin->releaseGPIOD();
+        intFd = -1;
+    }
+}
+
+// Pulse reset and send POWER_UP.  It is not waited for here, the caller's
+// setup runs while the crystal starts and the first command waits for CTS.
+void I2CSi4713::startReset() {
+    resetStart = std::chrono::steady_clock::now();
+    resetPin->setValue(0);
+    std::this_thread::sleep_for(std::chrono::microseconds(SI4713_RESET_LOW_US));
+    resetPin->setValue(1);
+    std::this_thread::sleep_for(std::chrono::microseconds(SI4713_RESET_SETTLE_US));
+    invalidateChipState();
+    uint8_t status = 0;
+    powerUpStart = std::chrono::steady_clock::now();
+    if (writeCommand(SI4710_CMD_POWER_UP, powerUpArgs(), status) < 0) {
+        LogWarn(VB_PLUGIN, "Failed sending POWER_UP to Si4713 at %X\n", address);
+    }
+    powerUpStatus = status;
+    powerUpPending = true;
+}
+
+
+std::vector<uint8_t> I2CSi4713::powerUpArgs() {
+    // crystal oscillator, transmit mode, GPO2 driven as INT if wired up
+    uint8_t arg1 = 0x12;
+    if (intFd >= 0) {
+        arg1 |= SI4710_POWER_UP_IN_GPO2OEN;
+    }
+    return {arg1, 0x50};
+}
+void I2CSi4713::enableInterrupts() {
+    if (intFd >= 0) {
+        setProperty(SI4713_PROP_GPO_IEN, SI4713_GPO_IEN_CTSIEN | SI4713_GPO_IEN_STCIEN);
+    }
+}
+// Wait for GPO2/INT to go low or for maxUs to pass.  Without an interrupt
+// pin this is the plain sleep that was always used.
+bool I2CSi4713::waitForInterrupt(int maxUs) {
+    if (intFd < 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(maxUs));
+        return false;
+    }
+    struct pollfd pfd;
+    pfd.fd = intFd;
+    pfd.events = POLLIN | POLLPRI;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, (maxUs + 999) / 1000) > 0) {
+        drainInterrupts();
+        missedInterrupts = 0;
+        return true;
+    }
+    if (++missedInterrupts >= 5) {
+        // GPO2 isn't wired or wasn't enabled at POWER_UP
+        LogWarn(VB_PLUGIN, "No interrupts from Si4713, falling back to polling\n");
+        releaseInterruptPin();
+    }
+    return false;
+}
+void I2CSi4713::drainInterrupts() {
+    if (intFd < 0) {
+        return;
+    }
+    struct pollfd pfd;
+    pfd.fd = intFd;
+    pfd.events = POLLIN | POLLPRI;
+    pfd.revents = 0;
+    uint8_t buf[64];
+    while (poll(&pfd, 1, 0) > 0) {
+        if (read(intFd, buf, sizeof(buf)) <= 0) {
+            break;
+        }
     }
 }
 
+// Finish the POWER_UP sent by the constructor, called before any other
+// command goes out
+void I2CSi4713::waitReady() {
+    if (!powerUpPending) {
+        return;
+    }
+    powerUpPending = false;
+    if (!waitForCTS(SI4710_CMD_POWER_UP, powerUpStatus, SI4713_POWER_UP_TIMEOUT, powerUpStart)) {
+        LogWarn(VB_PLUGIN, "Si4713 at %X did not come out of reset\n", address);
+    }
+    setProperty(SI4713_PROP_REFCLK_FREQ, 32768);
+    enableInterrupts();
+    auto ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - resetStart).count() / 1000.0;
+    LogInfo(VB_PLUGIN, "Si4713 at %X ready %.1f ms after reset\n", address, ms);
+}
+
+bool I2CSi4713::isPoweredUp() {
+    // GET_REV is only answered in powerup mode, an Si4713 reports part 13
+    std::vector<uint8_t> response(9);
+    if (!sendSi4711Command(SI4710_CMD_GET_REV, {0}, response, false)) {
+        return false;
+    }
+    return (response[0] & 0x80) && !(response[0] & 0x40) && response[1] == 13;
+}
 
 bool I2CSi4713::isOk() {
     return i2c != nullptr;
 }
 void I2CSi4713::powerUp() {
+    auto start = std::chrono::steady_clock::now();
+    // keeps whatever powerDown saved
+    invalidateChipState();
+    sendSi4711Command(SI4710_CMD_POWER_UP, powerUpArgs());
+    setProperty(SI4713_PROP_REFCLK_FREQ, 32768);
+    enableInterrupts();
+    restoreChipState();
+    auto ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+    LogInfo(VB_PLUGIN, "Si4713 at %X powered up in %.1f ms\n", address, ms);
 }
 void I2CSi4713::powerDown() {
+    saveChipState();
+    sendSi4711Command(SI4710_CMD_POWER_DOWN, {});
 }
 void I2CSi4713::reset() {
+    saveChipState();
+    startReset();
+    waitReady();
+    restoreChipState();
 }
 
 
@@ -88,6 +259,19 @@ std::string I2CSi4713::getRev() {
     return buf;
 }
 
+bool I2CSi4713::getProperty(uint16_t prop, uint16_t &val) {
+    std::vector<uint8_t> out(4);
+    if (!sendSi4711Command(SI4710_CMD_GET_PROPERTY, {0x00, (uint8_t)(prop >> 8), (uint8_t)prop}, out)) {
+        return false;
+    }
+    if (!(out[0] & 0x80) || (out[0] & 0x40)) {
+        LogWarn(VB_PLUGIN, "Failed to get property: %X\n", prop);
+        return false;
+    }
+    val = out[2] << 8 | out[3];
+    return true;
+}
+
 std::string I2CSi4713::getASQ() {
     std::vector<uint8_t> out;
     out.resize(8);
@@ -103,13 +287,22 @@ std::string I2CSi4713::getASQ() {
     r += " dBfs";
     return r;
 }
-std::string I2CSi4713::getTuneStatus() {
+bool I2CSi4713::readTuneStatus(int &frequency, int &power, int &antCap) {
     std::vector<uint8_t> out;
     out.resize(8);
-    sendSi4711Command(SI4710_CMD_TX_TUNE_STATUS, {0x1}, out);
-    int currFreq = out[2] << 8 | out[3];
-    int currdBuV = out[5];
-    int currAntCap = out[6];
+    if (!sendSi4711Command(SI4710_CMD_TX_TUNE_STATUS, {0x1}, out) || !(out[0] & 0x80)) {
+        return false;
+    }
+    frequency = out[2] << 8 | out[3];
+    power = out[5];
+    antCap = out[6];
+    return true;
+}
+std::string I2CSi4713::getTuneStatus() {
+    int currFreq = 0;
+    int currdBuV = 0;
+    int currAntCap = 0;
+    readTuneStatus(currFreq, currdBuV, currAntCap);
     
     float f = currFreq / 100.0f;
     
@@ -117,40 +310,131 @@ std::string I2CSi4713::getTuneStatus() {
     sprintf(buf, "Freq: %.1f MHz  -  Power: %d dBuV  -  ANTcap: %d", f, currdBuV, currAntCap);
     return buf;
 }
-bool I2CSi4713::sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &data, bool ignoreFailures) {
-    LogDebug(VB_PLUGIN, "Sending command %X    datasize: %d (no resp)(if: %d)\n", cmd, data.size(), ignoreFailures);
-    int i = i2c->writeBlockData(cmd, &data[0], data.size());
-    std::this_thread::sleep_for(std::chrono::microseconds(10000));
-    uint8_t out[1];
-    i = i2c->readI2CBlockData(0x00, out, 1);
-
-    if (cmd == SI4710_CMD_POWER_UP || cmd == SI4710_CMD_TX_TUNE_FREQ) {
-        for (int x = 0; x < 100; x++) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(3));
-            int i2 = i2c->writeBlockData(SI4710_CMD_GET_INT_STATUS, &data[0], 0);
-            i2 = i2c->readI2CBlockData(0x00, out, 1);
-            LogExcess(VB_PLUGIN, "   resp %X\n", (int)out[0]);
-            if (cmd == SI4710_CMD_POWER_UP) {
-                if (i2 > 0 && out[0] & 0x80) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(3));
-                    return true;
-                }
-            } else {
-                if (i2 > 0 && out[0] & 0x1) {
-                    return true;
+// Send a command and read the status byte back in the same I2C_RDWR
+// transaction, quick commands are often already clear to send by then
+int I2CSi4713::writeCommand(uint8_t cmd, const std::vector<uint8_t> &data, uint8_t &status) {
+    uint8_t buf[16];
+    if (data.size() >= sizeof(buf)) {
+        return -1;
+    }
+    buf[0] = cmd;
+    if (data.size()) {
+        memcpy(&buf[1], data.data(), data.size());
+    }
+    status = 0;
+    int i = i2c->transfer(address, buf, data.size() + 1, &status, 1);
+    if (i < 0 && recoverBus()) {
+        i = i2c->transfer(address, buf, data.size() + 1, &status, 1);
+    }
+    return i;
+}
+
+// Poll the status byte until CTS, true if the chip answers and isn't
+// reporting an error
+bool I2CSi4713::readStatus(int timeoutMs) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (true) {
+        uint8_t status = 0;
+        if (readResponse(&status, 1) > 0 && (status & 0x80)) {
+            return !(status & 0x40);
+        }
+        if (std::chrono::steady_clock::now() >= end) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+// Called when a transfer fails.  Each step is only tried if the ones
+// before it didn't bring the chip back: a bus clear, re-reading the
+// status, POWER_DOWN/POWER_UP with the cached state replayed and finally
+// a reset pulse.  Runs on the worker so playback carries on meanwhile.
+bool I2CSi4713::recoverBus() {
+    auto start = std::chrono::steady_clock::now();
+    if (recovering || start < nextRecovery) {
+        return false;
+    }
+    recovering = true;
+    LogWarn(VB_PLUGIN, "I2C transfer to Si4713 at %X failed, recovering\n", address);
+
+    // the clear only counts if the chip then returns a clear to send
+    // status without an error, SDA held low still reads back as zeros
+    int step = BusClear;
+    uint8_t status = 0;
+    if (!i2c->clear(address, status) || !(status & 0x80) || (status & 0x40)) {
+        step = Status;
+        if (!readStatus(SI4713_RECOVERY_STATUS_MS)) {
+            step = SoftInit;
+            powerDown();
+            powerUp();
+            if (!isPoweredUp()) {
+                step = GPIOReset;
+                reset();
+                if (!isPoweredUp()) {
+                    step = Failed;
                 }
             }
         }
-    } else if (SI4710_CMD_GET_INT_STATUS == 0x14 && !(out[0] & 0x80)) {
-        for (int x = 0; x < 10; x++) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(3));
-            int i2 = i2c->writeBlockData(SI4710_CMD_GET_INT_STATUS, &data[0], 0);
-            i2 = i2c->readI2CBlockData(0x00, out, 1);
-            LogExcess(VB_PLUGIN, "   resp %X\n", (int)out[0]);
-            if (out[0] & 0x80) {
-                return true;
-            }
+    }
+    recoveries[step]++;
+    recovering = false;
+
+    auto ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+    if (step == Failed) {
+        nextRecovery = std::chrono::steady_clock::now() + std::chrono::milliseconds(SI4713_RECOVERY_BACKOFF_MS);
+        LogErr(VB_PLUGIN, "Could not recover Si4713 at %X after %.1f ms\n", address, ms);
+        return false;
+    }
+    LogInfo(VB_PLUGIN, "Si4713 at %X recovered by %s in %.1f ms\n", address, recoveryNames[step], ms);
+    return true;
+}
+// Wait for STCINT after a tune command, woken by GPO2/INT if it is wired
+// and polling every few ms if not.  The status is checked before the
+// first wait as the CTS wait may already have swallowed the STC edge.
+// STCINT is acknowledged so the next tune raises the interrupt again.
+bool I2CSi4713::waitForSTC(int timeoutMs) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (true) {
+        uint8_t status = 0;
+        int i = writeCommand(SI4710_CMD_GET_INT_STATUS, {}, status);
+        // GET_INT_STATUS raises its own CTS interrupt, don't wake on it
+        drainInterrupts();
+        LogExcess(VB_PLUGIN, "   resp %X\n", (int)status);
+        if (i > 0 && (status & 0x1)) {
+            std::vector<uint8_t> ack(1);
+            sendSi4711Command(SI4710_CMD_TX_TUNE_STATUS, {0x1}, ack);
+            return true;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now >= end) {
+            LogDebug(VB_PLUGIN, "Timeout waiting for STC\n");
+            return false;
         }
+        int us = std::chrono::duration_cast<std::chrono::microseconds>(end - now).count();
+        waitForInterrupt(intFd >= 0 ? us : std::min(us, SI4713_STC_POLL_US));
+    }
+}
+int I2CSi4713::readResponse(uint8_t *buf, int len) {
+    return i2c->transfer(address, nullptr, 0, buf, len);
+}
+
+bool I2CSi4713::sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &data, bool ignoreFailures) {
+    LogDebug(VB_PLUGIN, "Sending command %X    datasize: %zu (no resp)(if: %d)\n", cmd, data.size(), ignoreFailures);
+    waitReady();
+    drainInterrupts();
+    auto start = std::chrono::steady_clock::now();
+    uint8_t out[1] = { 0 };
+    int i = writeCommand(cmd, data, out[0]);
+    // POWER_UP has to wait for the crystal to start
+    bool cts = i >= 0 && waitForCTS(cmd, out[0], cmd == SI4710_CMD_POWER_UP ? 500 : 100, start);
+
+    if (cmd == SI4710_CMD_TX_TUNE_FREQ || cmd == SI4710_CMD_TX_TUNE_POWER || cmd == SI4710_CMD_TX_TUNE_MEASURE) {
+        // CTS comes back right away, the tune is done at STC
+        if (cts && waitForSTC(SI4713_STC_TIMEOUT_MS)) {
+            return true;
+        }
+    } else if (cts) {
+        return true;
     }
     if (ignoreFailures || i >= 0) {
         LogExcess(VB_PLUGIN, "   resp2 %d,  %X\n", i, (int)out[0]);
@@ -161,20 +445,26 @@ bool I2CSi4713::sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &data,
 }
 
 bool I2CSi4713::sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &data, std::vector<uint8_t> &out, bool ignoreFailures) {
-    LogDebug(VB_PLUGIN, "Sending command %X    datasize: %d     toRead:  %d   if: %d\n", cmd, data.size(), out.size(), ignoreFailures);
-    int i = i2c->writeBlockData(cmd, &data[0], data.size());
+    LogDebug(VB_PLUGIN, "Sending command %X    datasize: %zu     toRead:  %zu   if: %d\n", cmd, data.size(), out.size(), ignoreFailures);
+    waitReady();
+    drainInterrupts();
+    auto start = std::chrono::steady_clock::now();
+    uint8_t status = 0;
+    int i = writeCommand(cmd, data, status);
     if (!ignoreFailures && i < 0) {
         return false;
     }
-    std::this_thread::sleep_for(std::chrono::microseconds(10000));
-    if (out.size()) {
-        i = i2c->readI2CBlockData(0x00, &out[0], out.size());
+    bool cts = waitForCTS(cmd, status, 100, start);
+    if (out.size() > 1) {
+        i = readResponse(&out[0], out.size());
+        LogExcess(VB_PLUGIN, "   read1 %d   %X\n", i, (int)out[0]);
+    } else if (out.size()) {
+        // the status byte is the whole response
+        out[0] = status;
         LogExcess(VB_PLUGIN, "   read1 %d   %X\n", i, (int)out[0]);
     } else {
-        uint8_t b[1];
-        i = i2c->readI2CBlockData(0x00, &b[0], 1);
-        LogExcess(VB_PLUGIN, "   read2 %d   %X\n", i, (int)b[0]);
-        if (!(b[0] & 0x80)) {
+        LogExcess(VB_PLUGIN, "   read2 %d   %X\n", i, (int)status);
+        if (!cts) {
             LogWarn(VB_PLUGIN, "Failed sending command: %X\n", cmd);
             return false;
         }
@@ -183,7 +473,7 @@ bool I2CSi4713::sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &data,
 }
 
 
-bool I2CSi4713::setProperty(uint16_t prop, uint16_t val) {
+bool I2CSi4713::writeProperty(uint16_t prop, uint16_t val) {
     LogDebug(VB_PLUGIN, "Set property: %X  val: %X\n", prop, val);
     std::vector<uint8_t> aucBuf(5);
     aucBuf[0] = 0x00;
@@ -195,11 +485,108 @@ bool I2CSi4713::setProperty(uint16_t prop, uint16_t val) {
     std::vector<uint8_t> retBuf(1);
 
     bool b = sendSi4711Command(SI4710_CMD_SET_PROPERTY, aucBuf, retBuf, false);
-    int i = retBuf[0];
-    std::this_thread::sleep_for(std::chrono::milliseconds(20));
     if (!(retBuf[0] & 0x80)) {
         LogWarn(VB_PLUGIN, "Failed to set property: %X  val: %X\n", prop, val);
         return false;
     }
     return b;
 }
+
+// Wait until the chip is clear to send again after a command written at
+// start.  status is what came back with the command, if that isn't CTS
+// yet then without the interrupt pin this sleeps for most of the time
+// this opcode usually takes and polls the status byte with an
+// exponential backoff.  The measured time feeds the per opcode table.
+bool I2CSi4713::waitForCTS(uint8_t cmd, uint8_t &status, int timeoutMs,
+                           std::chrono::steady_clock::time_point start) {
+    auto end = start + std::chrono::milliseconds(timeoutMs);
+    CommandLatency &latency = latencies[cmd];
+    // CTSIEN is only set after POWER_UP completes so there is no edge to
+    // wait for, poll it without counting a missed interrupt
+    bool useInterrupt = intFd >= 0 && cmd != SI4710_CMD_POWER_UP;
+    if (!(status & 0x80)) {
+        if (useInterrupt) {
+            waitForInterrupt(timeoutMs * 1000);
+        } else if (latency.samples) {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(latency.averageUs * 3 / 4));
+        }
+    }
+    int backoffUs = 50;
+    while (true) {
+        int i = 1;
+        if (!(status & 0x80)) {
+            i = readResponse(&status, 1);
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (i > 0 && (status & 0x80)) {
+            int us = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+            if (latency.samples == 0) {
+                latency.averageUs = us;
+                latency.minUs = us;
+                latency.maxUs = us;
+            } else {
+                latency.averageUs = (latency.averageUs * 7 + us) / 8;
+                latency.minUs = std::min(latency.minUs, us);
+                latency.maxUs = std::max(latency.maxUs, us);
+            }
+            latency.samples++;
+            return true;
+        }
+        if (now >= end) {
+            LogDebug(VB_PLUGIN, "Timeout waiting for CTS after command %X\n", cmd);
+            return false;
+        }
+        if (useInterrupt && intFd >= 0) {
+            auto left = std::chrono::duration_cast<std::chrono::microseconds>(end - now);
+            waitForInterrupt(std::max((int)left.count(), 0));
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(backoffUs));
+            backoffUs = std::min(backoffUs * 2, 2000);
+        }
+    }
+}
+
+std::string I2CSi4713::getStats() {
+    std::string r = Si4713::getStats() + "  " + i2c->getStats() + "  Recoveries:";
+    for (int x = 0; x < RecoveryCount; x++) {
+        r += " ";
+        r += recoveryNames[x];
+        r += ": " + std::to_string(recoveries[x]);
+    }
+    r += "  CTS latency us (avg/min/max/count):";
+    for (auto &l : latencies) {
+        char buf[100];
+        snprintf(buf, sizeof(buf), " %02X: %d/%d/%d/%u", (int)l.first, l.second.averageUs, l.second.minUs, l.second.maxUs, l.second.samples);
+        r += buf;
+    }
+    return r;
+}
+
+bool I2CSi4713::sendBatch(Batch &batch) {
+    // The chip only takes a new command once CTS is set so the items can't
+    // share one I2C_RDWR transaction, but each is a single write+status
+    // transaction and none of the fixed per command sleeps are needed.
+    waitReady();
+    bool ok = true;
+    uint8_t status = 0;
+    for (auto &item : batch.items) {
+        uint8_t cmd = item.cmd;
+        std::vector<uint8_t> data = item.data;
+        if (item.isProperty) {
+            LogDebug(VB_PLUGIN, "Batch set property: %X  val: %X\n", item.prop, item.val);
+            cmd = SI4710_CMD_SET_PROPERTY;
+            data = { 0x00, (uint8_t)(item.prop >> 8), (uint8_t)item.prop, (uint8_t)(item.val >> 8), (uint8_t)item.val };
+        } else {
+            LogDebug(VB_PLUGIN, "Batch command %X    datasize: %zu\n", cmd, data.size());
+        }
+        drainInterrupts();
+        auto start = std::chrono::steady_clock::now();
+        int i = writeCommand(cmd, data, status);
+        item.ok = i >= 0 && waitForCTS(cmd, status, 100, start) && !(status & 0x40);
+        if (!item.ok) {
+            LogWarn(VB_PLUGIN, "Batch item failed: %X  status: %X\n", item.isProperty ? item.prop : cmd, (int)status);
+            ok = false;
+        }
+    }
+    return ok;
+}
@@ -1,14 +1,22 @@
 #ifndef __I2CSI4713__
 #define __I2CSI4713__
 
+#include <array>
+#include <chrono>
+#include <map>
+#include <memory>
+
 #include "Si4713.h"
 
-class I2CUtils;
+class I2CBus;
 class PinCapabilities;
 
 class I2CSi4713 : public Si4713 {
 public:
-    I2CSi4713(const std::string &gpioPin);
+    // intPin is optional, if GPO2/INT is wired to a GPIO command completion
+    // is taken from its falling edge instead of fixed sleeps
+    // address is 0x63 with SEN high, 0x11 with SEN low
+    I2CSi4713(const std::string &gpioPin, const std::string &intPin = "", uint8_t address = 0x63);
     virtual ~I2CSi4713();
     
     
@@ -19,16 +27,67 @@ public:
     virtual void reset() override;
     virtual std::string getASQ() override;
     virtual std::string getTuneStatus() override;
+    virtual std::string getStats() override;
     
     
 protected:
     virtual bool sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &data, bool ignoreFailures = false) override;
     virtual bool sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &data, std::vector<uint8_t> &out, bool ignoreFailures = false) override;
-    virtual bool setProperty(uint16_t prop, uint16_t val) override;
+    virtual bool writeProperty(uint16_t prop, uint16_t val) override;
+    virtual bool getProperty(uint16_t prop, uint16_t &val) override;
+    virtual bool readTuneStatus(int &frequency, int &power, int &antCap) override;
+    virtual bool sendBatch(Batch &batch) override;
     
 private:
-    I2CUtils *i2c = nullptr;
+    void startReset();
+    void waitReady();
+    bool isPoweredUp();
+    int writeCommand(uint8_t cmd, const std::vector<uint8_t> &data, uint8_t &status);
+    int readResponse(uint8_t *buf, int len);
+    bool readStatus(int timeoutMs);
+    bool recoverBus();
+    bool waitForCTS(uint8_t cmd, uint8_t &status, int timeoutMs,
+                    std::chrono::steady_clock::time_point start);
+    bool waitForSTC(int timeoutMs);
+    std::vector<uint8_t> powerUpArgs();
+    void enableInterrupts();
+    bool waitForInterrupt(int maxUs);
+    void drainInterrupts();
+    void releaseInterruptPin();
+
+    std::shared_ptr<I2CBus> i2c;
+    uint8_t address = 0x63;
     const PinCapabilities *resetPin = nullptr;
+    const PinCapabilities *intPin = nullptr;
+    int intFd = -1;
+    int missedInterrupts = 0;
+
+    bool powerUpPending = false;
+    uint8_t powerUpStatus = 0;
+    std::chrono::steady_clock::time_point resetStart;
+    std::chrono::steady_clock::time_point powerUpStart;
+
+    class CommandLatency {
+    public:
+        uint32_t samples = 0;
+        int averageUs = 0;
+        int minUs = 0;
+        int maxUs = 0;
+    };
+    std::map<uint8_t, CommandLatency> latencies;
+
+    // the recovery step that got the chip talking again
+    enum RecoveryStep {
+        BusClear = 0,
+        Status,
+        SoftInit,
+        GPIOReset,
+        Failed,
+        RecoveryCount
+    };
+    bool recovering = false;
+    std::chrono::steady_clock::time_point nextRecovery;
+    std::array<uint64_t, RecoveryCount> recoveries = {};
 };
 
 #endif
@@ -81,6 +81,12 @@
 // TX_RDS_PS
 #define TX_RDS_PS 0x36
 
+// RadioText segments loaded per batch
+#define RDS_LOAD_BATCH 8
+
+// time budget for a whole PS or RadioText update
+#define RDS_UPDATE_BUDGET_MS 1000
+
 
 
 Si4713::Si4713() {
@@ -93,33 +99,303 @@ Si4713::~Si4713() {
 
 void Si4713::Init() {
     std::string rev = getRev();
-    //setProperty(SI4713_PROP_REFCLK_FREQ, 32768); // crystal is 32.768
-    setProperty(SI4713_PROP_TX_PREEMPHASIS, isEUPremphasis ? 1 : 0); // 75uS pre-emph (default for US)
+    Batch batch;
+    addInitProperties(batch);
+    runBatch(batch);
+}
+void Si4713::addInitProperties(Batch &batch) {
+    //batch.setProperty(SI4713_PROP_REFCLK_FREQ, 32768); // crystal is 32.768
+    batch.setProperty(SI4713_PROP_TX_PREEMPHASIS, isEUPremphasis ? 1 : 0); // 75uS pre-emph (default for US)
     
     uint16_t t = audioCompression ? 0x1 : 0;
     if (audioLimitter) {
         t |= 0x2;
     }
-    setProperty(SI4713_PROP_TX_ACOMP_ENABLE, t); // turn on limiter and AGC
-    setProperty(SI4713_PROP_TX_ACOMP_THRESHOLD, 0x10000 + audioCompressionThreshold);
-    setProperty(SI4713_PROP_TX_ATTACK_TIME, 0); // 0.5 ms
-    setProperty(SI4713_PROP_TX_RELEASE_TIME, 4); // 1000 ms
-    setProperty(SI4713_PROP_TX_ACOMP_GAIN, audioGain); // dB
+    batch.setProperty(SI4713_PROP_TX_ACOMP_ENABLE, t); // turn on limiter and AGC
+    batch.setProperty(SI4713_PROP_TX_ACOMP_THRESHOLD, 0x10000 + audioCompressionThreshold);
+    batch.setProperty(SI4713_PROP_TX_ATTACK_TIME, 0); // 0.5 ms
+    batch.setProperty(SI4713_PROP_TX_RELEASE_TIME, 4); // 1000 ms
+    batch.setProperty(SI4713_PROP_TX_ACOMP_GAIN, audioGain); // dB
+}
+
+bool Si4713::isConfigured(int frequency, int power, double antCap, bool rds) {
+    int curFreq = 0;
+    int curPower = 0;
+    int curAntCap = 0;
+    if (!readTuneStatus(curFreq, curPower, curAntCap)) {
+        return false;
+    }
+    LogDebug(VB_PLUGIN, "Current tune: %d  power: %d  antcap: %d\n", curFreq, curPower, curAntCap);
+    // antCap of 0 is auto tuned so whatever the chip picked is fine
+    if (curFreq != frequency || curPower != power || (antCap != 0 && curAntCap != (int)antCap)) {
+        return false;
+    }
+
+    Batch batch;
+    addInitProperties(batch);
+    if (rds) {
+        addRDSProperties(batch);
+    }
+    // a few properties that differ from the power on defaults are enough
+    // to tell if it was us that configured the chip with these settings
+    static const std::vector<uint16_t> FINGERPRINT = {
+        SI4713_PROP_TX_PREEMPHASIS,
+        SI4713_PROP_TX_ACOMP_ENABLE,
+        SI4713_PROP_TX_ACOMP_GAIN,
+        SI4713_PROP_TX_COMPONENT_ENABLE,
+        SI4713_PROP_TX_RDS_PI
+    };
+    for (auto &i : batch.items) {
+        if (std::find(FINGERPRINT.begin(), FINGERPRINT.end(), i.prop) == FINGERPRINT.end()) {
+            continue;
+        }
+        uint16_t val = 0;
+        if (!getProperty(i.prop, val) || val != i.val) {
+            LogDebug(VB_PLUGIN, "Property %X is %X, wanted %X\n", i.prop, val, i.val);
+            return false;
+        }
+    }
+    if (!rds) {
+        // RDS must be off, the fingerprint above didn't include it
+        uint16_t val = 0;
+        if (!getProperty(SI4713_PROP_TX_COMPONENT_ENABLE, val) || val != 0x0003) {
+            return false;
+        }
+    }
+
+    // The chip is as we left it.  Seed the shadow cache with what it
+    // actually has so a later Init/beginRDS only writes the settings that
+    // changed since (PTY, threshold...).  The message count follows the
+    // station text which is resent anyway so it isn't trusted.
+    for (auto &i : batch.items) {
+        if (i.prop == SI4713_PROP_TX_RDS_MESSAGE_COUNT) {
+            continue;
+        }
+        uint16_t val = 0;
+        if (getProperty(i.prop, val)) {
+            propertyCache[i.prop] = val;
+            if (val != i.val) {
+                LogDebug(VB_PLUGIN, "Property %X is %X, will be set to %X\n", i.prop, val, i.val);
+            }
+        }
+    }
+    return true;
 }
 
 
 void Si4713::setFrequency(int frequency) {
+    if (frequency == tunedFrequency) {
+        return;
+    }
     uint8_t ft = frequency>>8;
     uint8_t fl = 0x00FF & frequency;
-    sendSi4711Command(TX_TUNE_FREQ, {0x00, ft, fl});
+    if (sendSi4711Command(TX_TUNE_FREQ, {0x00, ft, fl})) {
+        tunedFrequency = frequency;
+    } else {
+        tunedFrequency = -1;
+    }
 }
 void Si4713::setTXPower(int power, double antCap) {
     uint8_t rfcap0 = antCap;
     if (rfcap0 > 191) {
         rfcap0 = 191;
     }
+    if (power == tunedPower && rfcap0 == tunedAntCap) {
+        return;
+    }
     uint8_t p = power & 0xff;
-    sendSi4711Command(TX_TUNE_POWER, {0x00, 0x00, p, rfcap0});
+    if (sendSi4711Command(TX_TUNE_POWER, {0x00, 0x00, p, rfcap0})) {
+        tunedPower = power;
+        tunedAntCap = rfcap0;
+    } else {
+        tunedPower = -1;
+        tunedAntCap = -1;
+    }
+}
+void Si4713::setMute(bool mute) {
+    setProperty(SI4713_PROP_TX_LINE_INPUT_MUTE, mute ? 0x0003 : 0x0000);
+}
+
+void Si4713::Batch::setProperty(uint16_t prop, uint16_t val) {
+    Item i;
+    i.isProperty = true;
+    i.prop = prop;
+    i.val = val;
+    items.push_back(i);
+}
+void Si4713::Batch::sendCommand(uint8_t cmd, const std::vector<uint8_t> &data) {
+    Item i;
+    i.cmd = cmd;
+    i.data = data;
+    items.push_back(i);
+}
+
+static bool isKnownProperty(uint16_t prop) {
+    switch (prop) {
+    case SI4713_PROP_GPO_IEN:
+    case SI4713_PROP_DIGITAL_INPUT_FORMAT:
+    case SI4713_PROP_DIGITAL_INPUT_SAMPLE_RATE:
+    case SI4713_PROP_REFCLK_FREQ:
+    case SI4713_PROP_REFCLK_PRESCALE:
+        return true;
+    }
+    if (prop >= SI4713_PROP_TX_COMPONENT_ENABLE && prop <= SI4713_PROP_TX_PILOT_FREQUENCY) {
+        return true;
+    }
+    if (prop >= SI4713_PROP_TX_ACOMP_ENABLE && prop <= SI4713_PROP_TX_LIMITER_RELEASE_TIME) {
+        return true;
+    }
+    if (prop >= SI4713_PROP_TX_ASQ_INTERRUPT_SOURCE && prop <= SI4713_PROP_TX_ASQ_DURATION_HIGH) {
+        return true;
+    }
+    if (prop >= SI4713_PROP_TX_RDS_INTERRUPT_SOURCE && prop <= SI4713_PROP_TX_RDS_FIFO_SIZE) {
+        return true;
+    }
+    return false;
+}
+
+bool Si4713::setProperty(uint16_t prop, uint16_t val) {
+    auto it = propertyCache.find(prop);
+    if (it != propertyCache.end() && it->second == val) {
+        propertyCacheHits++;
+        return true;
+    }
+    propertyCacheMisses++;
+    if (writeProperty(prop, val)) {
+        propertyCache[prop] = val;
+        return true;
+    }
+    // unknown what the chip has now
+    propertyCache.erase(prop);
+    return false;
+}
+void Si4713::invalidateChipState() {
+    propertyCache.clear();
+    lastStation.clear();
+    lastRDS.clear();
+    lastRTSegments.clear();
+    lastRtPlus.clear();
+    timestampLoaded = false;
+    tunedFrequency = -1;
+    tunedPower = -1;
+    tunedAntCap = -1;
+}
+void Si4713::saveChipState() {
+    // Merged into whatever is still saved so a second power down, or one
+    // after a restore that failed part way, doesn't lose anything
+    for (auto &p : propertyCache) {
+        savedProperties[p.first] = p.second;
+    }
+    if (tunedFrequency != -1) {
+        savedFrequency = tunedFrequency;
+    }
+    if (tunedPower != -1) {
+        savedPower = tunedPower;
+        savedAntCap = tunedAntCap;
+    }
+    invalidateChipState();
+}
+bool Si4713::restoreChipState() {
+    if (savedProperties.empty() && savedFrequency == -1) {
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    // properties first so the carrier comes up with the audio processing
+    // and RDS already set, then the tune which waits for STC
+    Batch batch;
+    for (auto &p : savedProperties) {
+        batch.setProperty(p.first, p.second);
+    }
+    bool ok = runBatch(batch);
+    if (savedPower != -1) {
+        setTXPower(savedPower, savedAntCap);
+        ok &= tunedPower != -1;
+    }
+    if (savedFrequency != -1) {
+        setFrequency(savedFrequency);
+        ok &= tunedFrequency != -1;
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    if (!ok) {
+        // kept for the next power up or reset to try again
+        LogWarn(VB_PLUGIN, "Restoring %d properties and tuning failed after %d us\n", (int)batch.items.size(), (int)us);
+        return false;
+    }
+    savedProperties.clear();
+    savedFrequency = -1;
+    savedPower = -1;
+    savedAntCap = -1;
+    LogInfo(VB_PLUGIN, "Restored %d properties and tuning in %d us\n", (int)batch.items.size(), (int)us);
+    return true;
+}
+std::string Si4713::getStats() {
+    return "Property cache hits/misses: " + std::to_string(propertyCacheHits) + "/" + std::to_string(propertyCacheMisses)
+        + "  RT segments written/changed/skipped: " + std::to_string(rtSegmentsWritten)
+        + "/" + std::to_string(rtSegmentsChanged) + "/" + std::to_string(rtSegmentsSkipped);
+}
+
+bool Si4713::runBatch(Batch &batch) {
+    for (auto &i : batch.items) {
+        if (i.isProperty && !isKnownProperty(i.prop)) {
+            LogWarn(VB_PLUGIN, "Batch rejected, unknown property: %X\n", i.prop);
+            return false;
+        }
+        // the Si4713 commands take at most 7 argument bytes, the RDS loads
+        // have always been sent with a trailing zero pad byte on top
+        if (!i.isProperty && i.data.size() > 7 && (i.data.size() > 8 || i.data.back() != 0)) {
+            LogWarn(VB_PLUGIN, "Batch rejected, too many arguments for command: %X\n", i.cmd);
+            return false;
+        }
+    }
+    // only send what the shadow cache says is not already on the chip
+    Batch toSend;
+    std::vector<Batch::Item *> sent;
+    for (auto &i : batch.items) {
+        if (i.isProperty) {
+            auto it = propertyCache.find(i.prop);
+            if (it != propertyCache.end() && it->second == i.val) {
+                propertyCacheHits++;
+                i.ok = true;
+                continue;
+            }
+            propertyCacheMisses++;
+        }
+        toSend.items.push_back(i);
+        sent.push_back(&i);
+    }
+    if (toSend.items.empty()) {
+        return true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool ok = sendBatch(toSend);
+    for (size_t x = 0; x < sent.size(); x++) {
+        Batch::Item &i = *sent[x];
+        i.ok = toSend.items[x].ok;
+        if (i.isProperty) {
+            if (i.ok) {
+                propertyCache[i.prop] = i.val;
+            } else {
+                propertyCache.erase(i.prop);
+            }
+        }
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    LogDebug(VB_PLUGIN, "Batch of %d items sent in %d us (%s)\n", (int)toSend.items.size(), (int)us, ok ? "ok" : "failed");
+    return ok;
+}
+
+bool Si4713::sendBatch(Batch &batch) {
+    bool ok = true;
+    for (auto &i : batch.items) {
+        if (i.isProperty) {
+            i.ok = writeProperty(i.prop, i.val);
+        } else {
+            i.ok = sendSi4711Command(i.cmd, i.data);
+        }
+        ok &= i.ok;
+    }
+    return ok;
 }
 
 bool Si4713::sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &data, bool ignoreFailures) {
@@ -128,29 +404,33 @@ bool Si4713::sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &data, bo
 }
 
 void Si4713::beginRDS() {
+    Batch batch;
+    addRDSProperties(batch);
+    runBatch(batch);
+}
+void Si4713::addRDSProperties(Batch &batch) {
     //66.25KHz (default is 68.25)
-    setProperty(SI4713_PROP_TX_AUDIO_DEVIATION, 6625);
+    batch.setProperty(SI4713_PROP_TX_AUDIO_DEVIATION, 6625);
     // 2KHz (default)
-    setProperty(SI4713_PROP_TX_RDS_DEVIATION, 200);
+    batch.setProperty(SI4713_PROP_TX_RDS_DEVIATION, 200);
     
     //RDS IRQ
-    setProperty(SI4713_PROP_TX_RDS_INTERRUPT_SOURCE, 0x0001);
+    batch.setProperty(SI4713_PROP_TX_RDS_INTERRUPT_SOURCE, 0x0001);
     // program identifier
-    setProperty(SI4713_PROP_TX_RDS_PI, 0x40A7);
+    batch.setProperty(SI4713_PROP_TX_RDS_PI, 0x40A7);
     // 50% mix (default)
-    setProperty(SI4713_PROP_TX_RDS_PS_MIX, 0x03);
+    batch.setProperty(SI4713_PROP_TX_RDS_PS_MIX, 0x03);
     //  RDSD0 & RDSMS (default)
     int i = (0x1848 & 0xFB1F) | (pty << 5);
-    uint16_t i2 = i;
-    setProperty(SI4713_PROP_TX_RDS_PS_MISC, i);
+    batch.setProperty(SI4713_PROP_TX_RDS_PS_MISC, i);
     // 3 repeats (default)
-    setProperty(SI4713_PROP_TX_RDS_PS_REPEAT_COUNT, 3);
+    batch.setProperty(SI4713_PROP_TX_RDS_PS_REPEAT_COUNT, 3);
     
-    setProperty(SI4713_PROP_TX_RDS_MESSAGE_COUNT, 1);
-    setProperty(SI4713_PROP_TX_RDS_PS_AF, 0xE0E0); // no AF
-    setProperty(SI4713_PROP_TX_RDS_FIFO_SIZE, 0);
+    batch.setProperty(SI4713_PROP_TX_RDS_MESSAGE_COUNT, 1);
+    batch.setProperty(SI4713_PROP_TX_RDS_PS_AF, 0xE0E0); // no AF
+    batch.setProperty(SI4713_PROP_TX_RDS_FIFO_SIZE, 0);
     
-    setProperty(SI4713_PROP_TX_COMPONENT_ENABLE, 0x0007);
+    batch.setProperty(SI4713_PROP_TX_COMPONENT_ENABLE, 0x0007);
 }
 void Si4713::setRDSStation(const std::vector<std::string> &station) {
     uint8_t buf[8];
@@ -159,10 +439,17 @@ void Si4713::setRDSStation(const std::vector<std::string> &station) {
         return;
     }
     lastStation = station;
+    auto previous = beginOperation(RDS_UPDATE_BUDGET_MS);
 
-    setProperty(SI4713_PROP_TX_RDS_MESSAGE_COUNT, station.size());
     uint8_t idx = 0;
+    size_t loaded = 0;
     for (auto &a : station) {
+        if (operationExpired()) {
+            // resent in full with the next update
+            LogWarn(VB_PLUGIN, "RDS station update ran out of time\n");
+            lastStation.clear();
+            break;
+        }
         int sl = a.size();
         memset(buf, ' ', 8);
         if (sl > 8) {
@@ -175,11 +462,41 @@ void Si4713::setRDSStation(const std::vector<std::string> &station) {
             sendSi4711Command(TX_RDS_PS, {idx, buf[i*4], buf[(i*4)+1], buf[(i*4)+2], buf[(i*4)+3], 0});
             idx++;
         }
+        loaded++;
+        preempt();
     }
+    // only rotate through the messages that were actually loaded, slots
+    // past them still hold the previous station text
+    if (loaded > 0 || station.empty()) {
+        setProperty(SI4713_PROP_TX_RDS_MESSAGE_COUNT, loaded);
+    }
+    endOperation(previous);
 }
 void Si4713::setRDSBuffer(const std::string &station,
                           int artistPos, int artistLen,
                           int titlePos, int titleLen) {
+    auto previous = beginOperation(RDS_UPDATE_BUDGET_MS);
+    setRDSText(station);
+    setRTPlus(artistPos, artistLen, titlePos, titleLen);
+    sendTimestamp();
+    endOperation(previous);
+}
+// nested operations share the outer budget, they can't extend it
+std::chrono::steady_clock::time_point Si4713::beginOperation(int budgetMs) {
+    auto previous = operationDeadline;
+    operationDeadline = std::min(operationDeadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(budgetMs));
+    return previous;
+}
+void Si4713::preempt() {
+    if (preemptCallback) {
+        // the preempting jobs aren't part of this update's budget
+        auto deadline = operationDeadline;
+        operationDeadline = std::chrono::steady_clock::time_point::max();
+        preemptCallback();
+        operationDeadline = deadline;
+    }
+}
+void Si4713::setRDSText(const std::string &station) {
     if (lastRDS == station) {
         return;
     }
@@ -202,30 +519,90 @@ void Si4713::setRDSBuffer(const std::string &station,
         }
     }
 
-    std::vector<uint8_t> resp(6);
+    // Compare the 4 character segments that actually go on air.  The
+    // circular buffer can only be appended to, there is no way to replace
+    // a single segment in it, so if anything differs the whole buffer has
+    // to be reloaded.  Text that only differs in trailing spaces or past
+    // 64 characters doesn't touch the bus at all.
+    std::vector<std::string> segments;
     if (station.size() != 0) {
-        int count = (sl + 3) / 4;
+        for (int i = 0; i < (sl + 3) / 4; i++) {
+            segments.push_back(std::string((char*)&buf[i * 4], 4));
+        }
+    }
+    if (segments == lastRTSegments) {
+        rtSegmentsSkipped += segments.size();
+        LogDebug(VB_PLUGIN, "RDS text segments unchanged, not reloading\n");
+        return;
+    }
+    for (size_t i = 0; i < segments.size(); i++) {
+        if (i >= lastRTSegments.size() || lastRTSegments[i] != segments[i]) {
+            rtSegmentsChanged++;
+        }
+    }
+    lastRTSegments = segments;
+    lastRtPlus.clear();
+    timestampLoaded = false;
+    auto previous = beginOperation(RDS_UPDATE_BUDGET_MS);
+
+    if (station.size() != 0) {
+        int count = segments.size();
         //printf("%d,   %s\n", count, station.c_str());
-        for (uint8_t i = 0; i < count; i++) {
-            uint8_t sb = TX_RDS_BUFF_IN_LDBUFF;
-            if (i == 0) {
-                sb |= TX_RDS_BUFF_IN_MTBUFF;
+        // the loads go out as batches so a transport that can pipeline
+        // them does, with a chance to preempt between the batches
+        Batch batch;
+        for (uint8_t i = 0; i <= count; i++) {
+            if (i == count) {
+                batch.sendCommand(TX_RDS_BUFF, {TX_RDS_BUFF_IN_LDBUFF, 0x20, i, 0x0d, 0x00, 0x00, 0x00, 0});
+            } else {
+                uint8_t sb = TX_RDS_BUFF_IN_LDBUFF;
+                if (i == 0) {
+                    sb |= TX_RDS_BUFF_IN_MTBUFF;
+                }
+                batch.sendCommand(TX_RDS_BUFF, {sb, 0x20, i, buf[i*4], buf[(i*4)+1], buf[(i*4)+2], buf[(i*4)+3], 0});
+            }
+            if (batch.items.size() == RDS_LOAD_BATCH || i == count) {
+                // Out of time nothing more is sent, the loads could only
+                // time out.  A partly loaded buffer is forgotten so the
+                // next update reloads it instead of taking it as on air.
+                bool expired = operationExpired();
+                if (!expired) {
+                    rtSegmentsWritten += batch.items.size();
+                }
+                if (expired || !runBatch(batch)) {
+                    LogWarn(VB_PLUGIN, "RadioText load %s at segment %d of %d\n", expired ? "ran out of time" : "failed",
+                            (int)(i + 1 - batch.items.size()), count + 1);
+                    lastRDS.clear();
+                    lastRTSegments.clear();
+                    endOperation(previous);
+                    return;
+                }
+                batch.items.clear();
+                preempt();
             }
-            sendSi4711Command(TX_RDS_BUFF, {sb, 0x20, i, buf[i*4], buf[(i*4)+1], buf[(i*4)+2], buf[(i*4)+3], 0}, resp);
-            LogExcess(VB_PLUGIN, "   res:  %2X %2X %2X %2X %2X %2X\n", resp[0], resp[1], resp[2], resp[3], resp[4], resp[5]);
         }
-        uint8_t idx = count;
-        sendSi4711Command(TX_RDS_BUFF, {TX_RDS_BUFF_IN_LDBUFF, 0x20, idx, 0x0d, 0x00, 0x00, 0x00, 0}, resp);
-        LogExcess(VB_PLUGIN, "   res:  %2X %2X %2X %2X %2X %2X\n", resp[0], resp[1], resp[2], resp[3], resp[4], resp[5]);
-        sendRtPlusInfo(1, titlePos, titleLen, 4, artistPos, artistLen);
     } else {
         sendSi4711Command(TX_RDS_BUFF, {TX_RDS_BUFF_IN_MTBUFF, 0, 0, 0, 0, 0, 0});
     }
-    sendTimestamp();
 
     setProperty(SI4713_PROP_TX_COMPONENT_ENABLE, 0x0007);
     sendSi4711Command(0x14, {});
     sendSi4711Command(TX_RDS_BUFF, {TX_RDS_BUFF_IN_INTACK, 0, 0, 0, 0, 0, 0});
+    endOperation(previous);
+}
+void Si4713::setRTPlus(int artistPos, int artistLen, int titlePos, int titleLen) {
+    if (lastRTSegments.empty() || operationExpired()) {
+        return;
+    }
+    // The RT+ groups are appended to the circular buffer, only once per
+    // RadioText load.  Without a reload they'd pile up behind the text
+    // they describe, and with a load that was cut short they'd describe
+    // text that isn't on air (lastRTSegments is empty then).
+    if (!lastRtPlus.empty()) {
+        return;
+    }
+    lastRtPlus = {artistPos, artistLen, titlePos, titleLen};
+    sendRtPlusInfo(1, titlePos, titleLen, 4, artistPos, artistLen);
 }
 
 
@@ -289,6 +666,11 @@ void Si4713::sendRtPlusInfo(int content1, int content1_pos, int content1_len,
 
 
 void Si4713::sendTimestamp() {
+    if (timestampLoaded || operationExpired()) {
+        return;
+    }
+    timestampLoaded = true;
+
     uint32_t MJD;
     int y, m, d, k;
     struct tm  *ltm;
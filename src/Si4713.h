@@ -2,11 +2,35 @@
 #define __SI4713__
 
 #include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <map>
 #include <vector>
 #include <string>
 
 class Si4713 {
 public:
+    // Property writes and commands collected so they can be validated up
+    // front and flushed together with runBatch.  Each item records its
+    // own result.
+    class Batch {
+    public:
+        class Item {
+        public:
+            bool isProperty = false;
+            uint16_t prop = 0;
+            uint16_t val = 0;
+            uint8_t cmd = 0;
+            std::vector<uint8_t> data;
+            bool ok = false;
+        };
+
+        void setProperty(uint16_t prop, uint16_t val);
+        void sendCommand(uint8_t cmd, const std::vector<uint8_t> &data);
+
+        std::vector<Item> items;
+    };
+
     Si4713();
     virtual ~Si4713();
 
@@ -23,6 +47,17 @@ public:
     void setEUPreemphasis() {isEUPremphasis = true;}
     void setFrequency(int frequency); // freq * 100,  so 8790 for 87.9
     void setTXPower(int power, double antCap);
+    // mutes the line input, the carrier and RDS stay on air
+    void setMute(bool mute);
+
+    // nothing is sent if any item fails validation
+    bool runBatch(Batch &batch);
+
+    // Reads back the tune status and a few key properties.  True if the
+    // chip is still configured from a previous run so the retune can be
+    // skipped.  The rest of the properties are read into the shadow cache,
+    // Init/beginRDS then only write the ones whose setting changed.
+    bool isConfigured(int frequency, int power, double antCap, bool rds);
     
 
     //RDS stuff
@@ -32,25 +67,86 @@ public:
     void setRDSBuffer(const std::string &rds,
                       int artistPos, int artistLen,
                       int titlePos, int titleLen);
+    // The pieces of setRDSBuffer so they can be queued independently.
+    // Loading new RadioText empties the circular buffer so the RT+ and
+    // CT groups are only (re)loaded once per RadioText load.
+    void setRDSText(const std::string &rds);
+    void setRTPlus(int artistPos, int artistLen, int titlePos, int titleLen);
     void sendTimestamp();
 
     void enableAudioCompression(bool b = true) { audioCompression = b; }
     void enableAudioLimitter(bool b = true) { audioLimitter = b; }
     void setAudioGain(int i) {audioGain = i;}
     void setAudioCompressionThreshold(int i) { audioCompressionThreshold = i;}
+
+    // called between the bus commands of long multi-command updates so
+    // more urgent work can be run in between
+    void setPreemptCallback(const std::function<void()> &cb) { preemptCallback = cb; }
+
+    virtual std::string getStats();
+protected:
+    // Writes through the shadow cache, a write of the value the chip
+    // already has is skipped.
+    bool setProperty(uint16_t prop, uint16_t val);
+    // the chip loses all properties and RDS buffers on reset/power down
+    void invalidateChipState();
+    // Remember the properties and tuning the chip has before it loses
+    // them so restoreChipState can put them back after the next POWER_UP
+    // without a full Init.  RDS buffers aren't kept, the next text update
+    // reloads them.
+    void saveChipState();
+    bool restoreChipState();
+    // sends the items one at a time, the transports override this when
+    // they can do better
+    virtual bool sendBatch(Batch &batch);
+    // While a multi-command RDS update runs this is when the whole update
+    // has to be done by, transports that wait for replies give up then
+    // instead of after a fixed time per reply
+    std::chrono::steady_clock::time_point getOperationDeadline() const { return operationDeadline; }
+
 private:
+    void preempt();
+    std::chrono::steady_clock::time_point beginOperation(int budgetMs);
+    void endOperation(std::chrono::steady_clock::time_point previous) { operationDeadline = previous; }
+    bool operationExpired() const { return std::chrono::steady_clock::now() >= operationDeadline; }
+    void addInitProperties(Batch &batch);
+    void addRDSProperties(Batch &batch);
+
     void sendRtPlusInfo(int content1, int content1_pos, int content1_len,
                         int content2, int content2_pos, int content2_len);
     
     virtual bool sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &data, bool ignoreFailures = false);
     virtual bool sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &data, std::vector<uint8_t> &out, bool ignoreFailures = false) = 0;
-    virtual bool setProperty(uint16_t prop, uint16_t val) = 0;
+    virtual bool writeProperty(uint16_t prop, uint16_t val) = 0;
+    virtual bool getProperty(uint16_t prop, uint16_t &val) = 0;
+    virtual bool readTuneStatus(int &frequency, int &power, int &antCap) = 0;
 
     
     bool isEUPremphasis = false;
     int pty = 2;
     std::vector<std::string> lastStation;
     std::string lastRDS;
+    std::vector<std::string> lastRTSegments;
+    std::vector<int> lastRtPlus;
+    bool timestampLoaded = false;
+    std::function<void()> preemptCallback;
+    std::chrono::steady_clock::time_point operationDeadline = std::chrono::steady_clock::time_point::max();
+
+    std::map<uint16_t, uint16_t> propertyCache;
+    // -1 if unknown
+    int tunedFrequency = -1;
+    int tunedPower = -1;
+    int tunedAntCap = -1;
+
+    std::map<uint16_t, uint16_t> savedProperties;
+    int savedFrequency = -1;
+    int savedPower = -1;
+    int savedAntCap = -1;
+    uint64_t propertyCacheHits = 0;
+    uint64_t propertyCacheMisses = 0;
+    uint64_t rtSegmentsWritten = 0;
+    uint64_t rtSegmentsChanged = 0;
+    uint64_t rtSegmentsSkipped = 0;
     
     bool audioCompression = true;
     bool audioLimitter = true;
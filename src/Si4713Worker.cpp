@@ -0,0 +1,143 @@
+#include <fpp-pch.h>
+
+#include "log.h"
+
+#include "Si4713Worker.h"
+
+constexpr Si4713Worker::Deadline Si4713Worker::NO_DEADLINE;
+
+static const char *kindNames[] = {
+    "Other",
+    "PS",
+    "RT",
+    "RT+",
+    "CT"
+};
+static const char *priorityNames[] = {
+    "Control",
+    "Normal",
+    "Status"
+};
+
+
+Si4713Worker::Si4713Worker() {
+    thread = std::thread(&Si4713Worker::run, this);
+}
+Si4713Worker::~Si4713Worker() {
+    stop();
+}
+
+void Si4713Worker::post(const std::function<void()> &job) {
+    post(Priority::Normal, Kind::None, job);
+}
+void Si4713Worker::post(Kind kind, const std::function<void()> &job, Deadline deadline) {
+    post(Priority::Normal, kind, job, deadline);
+}
+void Si4713Worker::post(Priority priority, const std::function<void()> &job, Deadline deadline) {
+    post(priority, Kind::None, job, deadline);
+}
+void Si4713Worker::post(Priority priority, Kind kind, const std::function<void()> &job, Deadline deadline) {
+    std::unique_lock<std::mutex> l(lock);
+    if (!running) {
+        return;
+    }
+    posted[(int)kind]++;
+    if (kind != Kind::None) {
+        // latest wins, the replacement goes to the back so it still runs
+        // after anything posted before it (RT must precede RT+ and CT)
+        for (auto &q : jobs) {
+            for (auto it = q.begin(); it != q.end(); ++it) {
+                if (it->kind == kind) {
+                    q.erase(it);
+                    dropped[(int)kind]++;
+                    LogExcess(VB_PLUGIN, "Dropping stale %s update\n", kindNames[(int)kind]);
+                    break;
+                }
+            }
+        }
+    }
+    jobs[(int)priority].push_back({kind, job, deadline});
+    cond.notify_one();
+}
+
+void Si4713Worker::preempt() {
+    if (std::this_thread::get_id() != thread.get_id()) {
+        return;
+    }
+    std::unique_lock<std::mutex> l(lock);
+    int p = currentPriority;
+    while (running && p > (int)Priority::Control && runNext(l, (int)Priority::Control)) {
+        preempted++;
+    }
+    currentPriority = p;
+}
+
+void Si4713Worker::stop() {
+    std::unique_lock<std::mutex> l(lock);
+    running = false;
+    for (auto &q : jobs) {
+        q.clear();
+    }
+    cond.notify_all();
+    l.unlock();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+std::string Si4713Worker::getStats() {
+    std::unique_lock<std::mutex> l(lock);
+    std::string r = "Updates posted/dropped:";
+    for (int x = 1; x < (int)Kind::Count; x++) {
+        r += " ";
+        r += kindNames[x];
+        r += ": " + std::to_string(posted[x]) + "/" + std::to_string(dropped[x]);
+    }
+    r += "  Executed:";
+    for (int x = 0; x < (int)Priority::Count; x++) {
+        r += " ";
+        r += priorityNames[x];
+        r += ": " + std::to_string(executed[x]);
+    }
+    r += "  Expired:";
+    for (int x = 0; x < (int)Priority::Count; x++) {
+        r += " ";
+        r += priorityNames[x];
+        r += ": " + std::to_string(expired[x]);
+    }
+    r += "  Preempted: " + std::to_string(preempted);
+    return r;
+}
+
+// run the highest priority job at or above maxPriority, lock held on entry and exit
+bool Si4713Worker::runNext(std::unique_lock<std::mutex> &l, int maxPriority) {
+    Deadline now = std::chrono::steady_clock::now();
+    for (int p = 0; p <= maxPriority; p++) {
+        while (!jobs[p].empty() && jobs[p].front().deadline < now) {
+            LogDebug(VB_PLUGIN, "Discarding expired %s job\n", kindNames[(int)jobs[p].front().kind]);
+            jobs[p].pop_front();
+            expired[p]++;
+        }
+        if (!jobs[p].empty()) {
+            std::function<void()> job = jobs[p].front().fn;
+            jobs[p].pop_front();
+            currentPriority = p;
+            executed[p]++;
+            l.unlock();
+            job();
+            l.lock();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Si4713Worker::run() {
+    std::unique_lock<std::mutex> l(lock);
+    while (running) {
+        if (!runNext(l, (int)Priority::Count - 1)) {
+            currentPriority = (int)Priority::Count;
+            cond.wait(l);
+        }
+    }
+}
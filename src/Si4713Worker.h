@@ -0,0 +1,85 @@
+#ifndef __SI4713WORKER__
+#define __SI4713WORKER__
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Single thread that owns all traffic to a transmitter.  Callers post
+// jobs and return immediately, the jobs are run on the worker in
+// priority order, FIFO within a priority.
+class Si4713Worker {
+public:
+    // Control is for tune/power/mute, Normal for RDS and start/stop,
+    // Status for diagnostics that only use otherwise idle bus time
+    enum class Priority {
+        Control = 0,
+        Normal,
+        Status,
+        Count
+    };
+    // Updates of the same kind replace each other while still queued so
+    // only the newest payload of each kind reaches the chip
+    enum class Kind {
+        None = 0,
+        PS,
+        RT,
+        RTPlus,
+        CT,
+        Count
+    };
+
+    // Jobs still queued after their deadline are discarded without
+    // touching the bus
+    typedef std::chrono::steady_clock::time_point Deadline;
+    static constexpr Deadline NO_DEADLINE = Deadline::max();
+
+    Si4713Worker();
+    virtual ~Si4713Worker();
+
+    void post(const std::function<void()> &job);
+    void post(Kind kind, const std::function<void()> &job, Deadline deadline = NO_DEADLINE);
+    void post(Priority priority, const std::function<void()> &job, Deadline deadline = NO_DEADLINE);
+    void post(Priority priority, Kind kind, const std::function<void()> &job, Deadline deadline = NO_DEADLINE);
+
+    // Called by a running job between bus commands.  Runs any queued
+    // Control jobs first so a long RDS load cannot delay a retune.
+    // Control jobs must therefore only issue chip commands.
+    void preempt();
+
+    // stop the thread, any jobs not yet started are discarded
+    void stop();
+
+    std::string getStats();
+
+private:
+    class Job {
+    public:
+        Kind kind;
+        std::function<void()> fn;
+        Deadline deadline;
+    };
+    void run();
+    bool runNext(std::unique_lock<std::mutex> &l, int maxPriority);
+
+    std::mutex lock;
+    std::condition_variable cond;
+    std::array<std::list<Job>, (int)Priority::Count> jobs;
+    bool running = true;
+    int currentPriority = (int)Priority::Count;
+
+    std::array<uint64_t, (int)Kind::Count> posted = {};
+    std::array<uint64_t, (int)Kind::Count> dropped = {};
+    std::array<uint64_t, (int)Priority::Count> executed = {};
+    std::array<uint64_t, (int)Priority::Count> expired = {};
+    uint64_t preempted = 0;
+
+    std::thread thread;
+};
+
+#endif
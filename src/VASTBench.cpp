@@ -0,0 +1,125 @@
+#include <fpp-pch.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/resource.h>
+
+#include "VASTFMT.h"
+
+// USB benchmarks for the VAST-FMT, run with fppd stopped.
+//
+//   ./vastbench pipeline [max window] [commands per window]
+//     commands per second at each pipeline window, the PS text on air
+//     is overwritten while it runs
+//   ./vastbench latency [requests]
+//     request/reply round trip with 1, 2 and 4 IN transfers queued
+//   ./vastbench backend [requests]
+//     round trip and CPU time per request for hidraw, libusb with the
+//     read thread and synchronous libusb
+//
+// Without arguments all of them are run with the defaults.
+
+#define TX_RDS_PS 0x36
+
+static void benchPipeline(int maxWindow, int count) {
+    VASTFMT vast;
+    if (!vast.isOk()) {
+        fprintf(stderr, "No VAST-FMT found\n");
+        return;
+    }
+    printf("%s\n", vast.getRev().c_str());
+    printf("window  commands  failed      ms     cmds/s\n");
+    for (int w = 1; w <= maxWindow; w++) {
+        vast.setPipelineWindow(w);
+        Si4713::Batch batch;
+        for (int x = 0; x < count; x++) {
+            batch.sendCommand(TX_RDS_PS, {0, 'B', 'N', 'C', 'H'});
+        }
+        auto start = std::chrono::steady_clock::now();
+        vast.runBatch(batch);
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        int failed = 0;
+        for (auto &i : batch.items) {
+            if (!i.ok) {
+                failed++;
+            }
+        }
+        printf("%6d  %8d  %6d  %6.1f  %9.1f\n", w, count, failed, us / 1000.0, count * 1000000.0 / us);
+    }
+    printf("%s\n", vast.getStats().c_str());
+}
+
+static void benchLatency(int count) {
+    printf("transfers  requests     avg ms     max ms\n");
+    for (int t : {1, 2, 4}) {
+        VASTFMT::setInputTransfers(t);
+        VASTFMT vast;
+        if (!vast.isOk()) {
+            fprintf(stderr, "No VAST-FMT found\n");
+            return;
+        }
+        long long total = 0;
+        long long worst = 0;
+        for (int x = 0; x < count; x++) {
+            auto start = std::chrono::steady_clock::now();
+            vast.getTuneStatus();
+            long long us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            total += us;
+            worst = std::max(worst, us);
+        }
+        printf("%9d  %8d  %9.2f  %9.2f\n", t, count, total / 1000.0 / count, worst / 1000.0);
+    }
+}
+
+static double cpuMs() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000.0 + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000.0;
+}
+
+static void benchBackend(int count) {
+    static const char *names[] = {"libusb", "sync", "hidraw"};
+    printf("backend  requests     avg ms     max ms  cpu ms/req\n");
+    // hidraw first, the hidraw node only comes back a little after the
+    // libusb runs hand the interface back to the kernel
+    for (VASTFMT::Backend requested : {VASTFMT::Backend::HIDRaw, VASTFMT::Backend::LibUSB, VASTFMT::Backend::Synchronous}) {
+        VASTFMT vast(requested);
+        if (!vast.isOk()) {
+            fprintf(stderr, "No VAST-FMT found\n");
+            return;
+        }
+        long long total = 0;
+        long long worst = 0;
+        double cpuStart = cpuMs();
+        for (int x = 0; x < count; x++) {
+            auto start = std::chrono::steady_clock::now();
+            vast.getTuneStatus();
+            long long us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            total += us;
+            worst = std::max(worst, us);
+        }
+        double cpu = cpuMs() - cpuStart;
+        // a fallback is reported as what actually ran
+        printf("%7s  %8d  %9.2f  %9.2f  %10.3f%s\n", names[(int)vast.getBackend()], count,
+               total / 1000.0 / count, worst / 1000.0, cpu / count,
+               vast.getBackend() != requested ? "  (fallback)" : "");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *mode = argc > 1 ? argv[1] : "";
+    if (!strcmp(mode, "pipeline")) {
+        benchPipeline(argc > 2 ? atoi(argv[2]) : 8, argc > 3 ? atoi(argv[3]) : 200);
+    } else if (!strcmp(mode, "latency")) {
+        benchLatency(argc > 2 ? atoi(argv[2]) : 200);
+    } else if (!strcmp(mode, "backend")) {
+        benchBackend(argc > 2 ? atoi(argv[2]) : 200);
+    } else {
+        benchPipeline(8, 200);
+        benchLatency(200);
+        benchBackend(200);
+    }
+    return 0;
+}
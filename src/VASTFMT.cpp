@@ -2,6 +2,7 @@
 
 
 #include <cstring>
+#include <deque>
 #include <sys/time.h>
 
 #include "log.h"
@@ -49,9 +50,14 @@ static const char *si471x_requests[] = {
     "Frontend Disable Audio",
     "EEPROM Read",
     "EEPROM Write",
+    "Frontend ASQ Status",
+    "Frontend Tune Status",
     "unknown"
 };
-#define Si471xRequestStr(x) (x < RequestUnknown ? si471x_requests[x] : si471x_requests[RequestUnknown])
+static inline const char *Si471xRequestStr(unsigned int x) {
+    const unsigned int count = sizeof(si471x_requests) / sizeof(si471x_requests[0]);
+    return x < count ? si471x_requests[x] : si471x_requests[count - 1];
+}
 
 enum {
     SI4711_OK = 0,
@@ -69,7 +75,10 @@ static const char *si471x_statuses[] = {
     "No CTS!",
     "unknown"
 };
-#define Si471xStatusStr(x) (x < SI4711_ERROR_UNKNOWN ? si471x_statuses[x] : si471x_statuses[SI4711_ERROR_UNKNOWN])
+static inline const char *Si471xStatusStr(unsigned int x) {
+    const unsigned int count = sizeof(si471x_statuses) / sizeof(si471x_statuses[0]);
+    return x < count ? si471x_statuses[x] : si471x_statuses[count - 1];
+}
 
 
 #define PCRequestError      0x80
@@ -84,14 +93,45 @@ static const char *si471x_statuses[] = {
 #define STATUS_BIT_ERR     0x40
 #define STATUS_BIT_CTS     0x80
 
+// how long to wait for the reply to a request
+#define VAST_TIMEOUT_MS    250
+
+// Si4711 commands the firmware just forwards and that don't depend on
+// the reply to the one before, these can be pipelined
+#define SI4711_CMD_TX_RDS_BUFF  0x35
+#define SI4711_CMD_TX_RDS_PS    0x36
+
+
+VASTFMT::VASTFMT(Backend requested, bool fallback) : Si4713() {
+    if (requested == Backend::HIDRaw) {
+        phd = hid_open_hidraw(_usVID, _usPID);
+        if (phd) {
+            backend = Backend::HIDRaw;
+            powerUp();
+            return;
+        }
+        if (!fallback) {
+            return;
+        }
+        LogWarn(VB_PLUGIN, "Si4713/USB: no hidraw device found, using libusb\n");
+    }
 
-VASTFMT::VASTFMT() : Si4713() {
     struct hid_device_info *phdi = nullptr;
     phdi = hid_enumerate(_usVID,_usPID);
     if (phdi == nullptr) {
         return;
     }
+    if (requested == Backend::Synchronous) {
+        synchronous = hid_set_synchronous(1) == 0;
+        if (!synchronous) {
+            LogWarn(VB_PLUGIN, "Si4713/USB: synchronous reads not supported, using the read thread\n");
+        }
+    }
     phd = hid_open_path(phdi->path);
+    if (synchronous) {
+        hid_set_synchronous(0);
+        backend = Backend::Synchronous;
+    }
     hid_free_enumeration(phdi);
     phdi=nullptr;
     
@@ -109,6 +149,69 @@ bool VASTFMT::isOk() {
     return phd != nullptr;
     
 }
+// Send one request and wait for its reply.  Anything already queued is a
+// late reply to an earlier request that timed out so it is thrown away
+// first, and replies echoing a different request code are skipped, so
+// one slow reply can't shift every later response by one.
+int VASTFMT::transact(unsigned char *bufOut, unsigned char *bufIn, int inLen, int timeoutMs) {
+    drainReports();
+    if (hid_write(phd, bufOut, 43) < 0) {
+        LogWarn(VB_PLUGIN, "Si4713/USB: write failed for request %s\n", Si471xRequestStr(bufOut[2]));
+        return -1;
+    }
+    uint8_t request = bufOut[2];
+    struct timespec end = replyDeadline(timeoutMs);
+    while (true) {
+        int r = hid_read_deadline(phd, bufIn, inLen, &end);
+        if (r <= 0) {
+            if (r == 0) {
+                timeouts++;
+            }
+            return r;
+        }
+        if (r >= 2 && ((bufIn[1] & ~RequestDone) == request || (bufIn[0] & PCRequestError))) {
+            return r;
+        }
+        mismatchedReplies++;
+        LogDebug(VB_PLUGIN, "Si4713/USB: skipping reply to %s while waiting for %s\n",
+                 Si471xRequestStr(bufIn[1] & ~RequestDone), Si471xRequestStr(request));
+    }
+}
+
+// When the reply to a request is due: timeoutMs from now, or sooner if
+// that is past the deadline of the update this request is part of.
+// hidapi takes CLOCK_MONOTONIC, which steady_clock isn't on every
+// platform, so it is converted through the time remaining.
+struct timespec VASTFMT::replyDeadline(int timeoutMs) {
+    auto now = std::chrono::steady_clock::now();
+    auto end = std::min(now + std::chrono::milliseconds(timeoutMs), getOperationDeadline());
+    long long ns = std::max((long long)std::chrono::duration_cast<std::chrono::nanoseconds>(end - now).count(), 0LL);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ns / 1000000000LL;
+    ts.tv_nsec += ns % 1000000000LL;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+void VASTFMT::drainReports() {
+    unsigned char stale[64];
+    while (hid_read_timeout(phd, stale, sizeof(stale), 0) > 0) {
+        staleReports++;
+    }
+}
+
+std::string VASTFMT::getStats() {
+    return Si4713::getStats() + "  USB stale/mismatched/timeouts: " + std::to_string(staleReports)
+        + "/" + std::to_string(mismatchedReplies) + "/" + std::to_string(timeouts)
+        + "  Overflowed: " + std::to_string(phd ? hid_get_overflow_count(phd) : 0)
+        + (synchronous ? "  Synchronous" : "")
+        + "  Pipelined: " + std::to_string(pipelined) + " (window " + std::to_string(pipelineWindow) + ")";
+}
+
 bool VASTFMT::sendDeviceCommand(uint8_t cmd, bool ignoreFailures) {
     std::vector<uint8_t> out;
     return sendDeviceCommand(cmd, out, ignoreFailures);
@@ -124,8 +227,7 @@ bool VASTFMT::sendDeviceCommand(uint8_t cmd, std::vector<uint8_t> &dataOut, bool
     aucBufOut[1] = PCTransfer;
     aucBufOut[2] = cmd;
     
-    hid_write(phd, aucBufOut, 43);
-    int r = hid_read_timeout(phd, aucBufIn, 43, 250);
+    int r = transact(aucBufOut, aucBufIn, 43, VAST_TIMEOUT_MS);
 
     if (r < 2) {
         LogWarn(VB_PLUGIN, "Si4713/USB: not enough data: %d\n", r);
@@ -148,11 +250,8 @@ bool VASTFMT::sendDeviceCommand(uint8_t cmd, std::vector<uint8_t> &dataOut, bool
     }
     return false;
 }
-bool VASTFMT::sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &dataIn, std::vector<uint8_t> &dataOut, bool ignoreFailures) {
-    unsigned char aucBufIn[43];
-    unsigned char aucBufOut[43];
+static void fillAccessRequest(unsigned char *aucBufOut, uint8_t cmd, const std::vector<uint8_t> &dataIn) {
     memset(aucBufOut, 0x00, 43); // Clear out the response buffer
-    memset(aucBufIn, 0xCC, 43); // Clear out the response buffer
     
     /* Send a BL Query Command */
     aucBufOut[0] = 0; // Report ID, ignored
@@ -163,10 +262,9 @@ bool VASTFMT::sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &dataIn,
     if (dataIn.size() > 0) {
         memcpy(&aucBufOut[5], &dataIn[0], dataIn.size());
     }
-
-    hid_write(phd, aucBufOut, 43);
-    int r = hid_read_timeout(phd, aucBufIn, 42, 250);
-    if (r == 0) {
+}
+static bool checkAccessReply(const unsigned char *aucBufIn, int r, bool ignoreFailures) {
+    if (r <= 0) {
         LogWarn(VB_PLUGIN, "Si4711/USB: command timed out (%d): %s, returned (FALSE)\n", aucBufIn[2], Si471xStatusStr(aucBufIn[2]));
         return false;
     }
@@ -192,6 +290,18 @@ bool VASTFMT::sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &dataIn,
         LogWarn(VB_PLUGIN, "Si4711/USB: I2C_READ failed, too much bytes received: %d\n", aucBufIn[4]);
         return false;
     }
+    return true;
+}
+bool VASTFMT::sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &dataIn, std::vector<uint8_t> &dataOut, bool ignoreFailures) {
+    unsigned char aucBufIn[43];
+    unsigned char aucBufOut[43];
+    memset(aucBufIn, 0xCC, 43); // Clear out the response buffer
+    fillAccessRequest(aucBufOut, cmd, dataIn);
+
+    int r = transact(aucBufOut, aucBufIn, 42, VAST_TIMEOUT_MS);
+    if (!checkAccessReply(aucBufIn, r, ignoreFailures)) {
+        return false;
+    }
     
     //LogDebug(VB_PLUGIN, "Si4711/USB: Volume: %d.%d (deviation: %d)\n", (int) aucBufIn[21], (int ) aucBufIn[22], (int ) (aucBufIn[23] << 8 | aucBufIn[24]));
     //printf("Si4711/USB: Volume: %d.%d (deviation: %d)\n", (int ) aucBufIn[21], (int ) aucBufIn[22], (int ) (aucBufIn[23] << 8 | aucBufIn[24]));
@@ -201,11 +311,8 @@ bool VASTFMT::sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &dataIn,
     memcpy(&dataOut[0], &aucBufIn[5], sz);
     return true;
 }
-bool VASTFMT::setProperty(uint16_t prop, uint16_t val) {
-    unsigned char aucBufIn[43];
-    unsigned char aucBufOut[43];
+static void fillSetPropRequest(unsigned char *aucBufOut, uint16_t prop, uint16_t val) {
     memset(aucBufOut, 0x00, 43); // Clear out the response buffer
-    memset(aucBufIn, 0xCC, 43); // Clear out the response buffer
     aucBufOut[0] = 0x00;            //report number, would be unused!
     aucBufOut[1] = PCTransfer;      //
     aucBufOut[2] = RequestSi4711SetProp;
@@ -213,9 +320,9 @@ bool VASTFMT::setProperty(uint16_t prop, uint16_t val) {
     aucBufOut[4] = prop;
     aucBufOut[5] = val >> 8;
     aucBufOut[6] = val;
-    hid_write(phd, aucBufOut, 43);
-    int r = hid_read_timeout(phd, aucBufIn, 42, 250);
-    if (r == 0) {
+}
+static bool checkSetPropReply(const unsigned char *aucBufIn, int r, uint16_t prop, uint16_t val) {
+    if (r <= 0) {
         LogWarn(VB_PLUGIN, "Si4711/USB: request error for property %X - timeout.\n", prop);
         return false;
     }
@@ -247,11 +354,132 @@ bool VASTFMT::setProperty(uint16_t prop, uint16_t val) {
     }
     
     if (aucBufIn[6] != 1) {
-        LogWarn(VB_PLUGIN, "Si4713/USB: Device request \"%s\" failed (%02x): %s (false!)\n", Si471xRequestStr(RequestSi4711SetProp), aucBufIn[6]);
+        LogWarn(VB_PLUGIN, "Si4713/USB: Device request \"%s\" failed (%02x) (false!)\n", Si471xRequestStr(RequestSi4711SetProp), aucBufIn[6]);
+        return false;
+    }
+    return true;
+}
+bool VASTFMT::writeProperty(uint16_t prop, uint16_t val) {
+    unsigned char aucBufIn[43];
+    unsigned char aucBufOut[43];
+    memset(aucBufIn, 0xCC, 43); // Clear out the response buffer
+    fillSetPropRequest(aucBufOut, prop, val);
+    int r = transact(aucBufOut, aucBufIn, 42, VAST_TIMEOUT_MS);
+    return checkSetPropReply(aucBufIn, r, prop, val);
+}
+static std::function<void(bool)> hotplugFn;
+static void hotplugEvent(int arrived, void *) {
+    hotplugFn(arrived != 0);
+}
+bool VASTFMT::watchHotplug(const std::function<void(bool)> &fn) {
+    hotplugFn = fn;
+    if (hid_hotplug_register(_usVID, _usPID, hotplugEvent, nullptr) < 0) {
+        hotplugFn = nullptr;
         return false;
     }
     return true;
 }
+void VASTFMT::unwatchHotplug() {
+    hid_hotplug_deregister();
+    hotplugFn = nullptr;
+}
+void VASTFMT::setInputTransfers(int count) {
+    if (hid_set_input_transfers(count) < 0) {
+        LogWarn(VB_PLUGIN, "Si4713/USB: invalid number of IN transfers: %d\n", count);
+    }
+}
+
+void VASTFMT::setPipelineWindow(int w) {
+    pipelineWindow = synchronous ? 1 : std::max(w, 1);
+}
+
+// Property sets and RDS buffer loads are written up to pipelineWindow
+// requests ahead of their replies.  The firmware answers in order so the
+// replies are matched to the oldest outstanding request.  Anything else
+// (tuning, power) waits for the pipe to empty and is sent on its own.
+bool VASTFMT::sendBatch(Batch &batch) {
+    if (pipelineWindow <= 1) {
+        return Si4713::sendBatch(batch);
+    }
+    drainReports();
+
+    unsigned char aucBufIn[43];
+    unsigned char aucBufOut[43];
+    std::deque<size_t> inflight;
+    // the reply to the oldest request is due by replyEnd, unrelated
+    // reports arriving meanwhile don't extend it
+    size_t waitingFor = batch.items.size();
+    struct timespec replyEnd;
+    bool barrier = false;
+    bool ok = true;
+    size_t next = 0;
+    while (next < batch.items.size() || !inflight.empty()) {
+        while (!barrier && next < batch.items.size() && (int)inflight.size() < pipelineWindow) {
+            Batch::Item &item = batch.items[next];
+            bool queueable = item.isProperty || item.cmd == SI4711_CMD_TX_RDS_BUFF || item.cmd == SI4711_CMD_TX_RDS_PS;
+            if (!queueable && !inflight.empty()) {
+                break;
+            }
+            if (item.isProperty) {
+                fillSetPropRequest(aucBufOut, item.prop, item.val);
+            } else {
+                fillAccessRequest(aucBufOut, item.cmd, item.data);
+            }
+            next++;
+            if (hid_write(phd, aucBufOut, 43) < 0) {
+                LogWarn(VB_PLUGIN, "Si4713/USB: write failed for request %s\n", Si471xRequestStr(aucBufOut[2]));
+                item.ok = false;
+                ok = false;
+                continue;
+            }
+            if (!inflight.empty()) {
+                pipelined++;
+            }
+            inflight.push_back(next - 1);
+            barrier = !queueable;
+        }
+        if (inflight.empty()) {
+            continue;
+        }
+
+        Batch::Item &item = batch.items[inflight.front()];
+        uint8_t request = item.isProperty ? RequestSi4711SetProp : RequestSi4711Access;
+        if (waitingFor != inflight.front()) {
+            waitingFor = inflight.front();
+            replyEnd = replyDeadline(VAST_TIMEOUT_MS);
+        }
+        memset(aucBufIn, 0xCC, 43);
+        int r = hid_read_deadline(phd, aucBufIn, 42, &replyEnd);
+        if (r >= 2 && (aucBufIn[1] & ~RequestDone) != request && !(aucBufIn[0] & PCRequestError)) {
+            mismatchedReplies++;
+            continue;
+        }
+        if (r <= 0) {
+            // the device stopped answering: replies still queued behind
+            // this one can't be matched any more, so fail whatever is in
+            // flight or unsent and drop late reports before anything else
+            // gets written
+            timeouts++;
+            for (auto i : inflight) {
+                batch.items[i].ok = false;
+            }
+            inflight.clear();
+            drainReports();
+            ok = false;
+            break;
+        }
+        if (item.isProperty) {
+            item.ok = checkSetPropReply(aucBufIn, r, item.prop, item.val);
+        } else {
+            item.ok = checkAccessReply(aucBufIn, r, false);
+        }
+        ok &= item.ok;
+        inflight.pop_front();
+        barrier = false;
+    }
+    return ok;
+}
+
 bool VASTFMT::getProperty(uint16_t prop, uint16_t &val) {
     unsigned char aucBufIn[43];
     unsigned char aucBufOut[43];
@@ -262,9 +490,8 @@ bool VASTFMT::getProperty(uint16_t prop, uint16_t &val) {
     aucBufOut[2] = RequestSi4711GetProp;
     aucBufOut[3] = prop >> 8;
     aucBufOut[4] = prop;
-    hid_write(phd, aucBufOut, 43);
-    int r = hid_read_timeout(phd, aucBufIn, 42, 250);
-    if (r == 0) {
+    int r = transact(aucBufOut, aucBufIn, 42, VAST_TIMEOUT_MS);
+    if (r <= 0) {
         LogWarn(VB_PLUGIN, "Si4713/USB: request error for property %X - timeout.\n", prop);
         return false;
     }
@@ -296,19 +523,22 @@ bool VASTFMT::getProperty(uint16_t prop, uint16_t &val) {
     }
     
     if (aucBufIn[6] != 1) {
-        LogWarn(VB_PLUGIN, "Si4713/USB: Device request \"%s\" failed (%02x): %s (false!)\n", Si471xRequestStr(RequestSi4711SetProp), aucBufIn[6]);
+        LogWarn(VB_PLUGIN, "Si4713/USB: Device request \"%s\" failed (%02x) (false!)\n", Si471xRequestStr(RequestSi4711SetProp), aucBufIn[6]);
         return false;
     }
     val = (int16_t ) ((aucBufIn[4] & 0x00FF) << 8) | aucBufIn[5];
     return true;
 }
 void VASTFMT::powerUp() {
+    invalidateChipState();
     sendDeviceCommand(RequestSi4711PowerUp, true);
 }
 void VASTFMT::powerDown() {
+    invalidateChipState();
     sendDeviceCommand(RequestSi4711PowerDown, true);
 }
 void VASTFMT::reset() {
+    invalidateChipState();
     sendDeviceCommand(RequestSi4711Reset, true);
 }
 std::string VASTFMT::getRev() {
@@ -339,13 +569,19 @@ std::string VASTFMT::getASQ() {
     }
     return "";
 }
-std::string VASTFMT::getTuneStatus() {
+bool VASTFMT::readTuneStatus(int &frequency, int &power, int &antCap) {
     std::vector<uint8_t> out;
-    if (sendDeviceCommand(RequestSi4711TuneStatus, out)) {
-        int currFreq = out[1] << 8 | out[2];
-        int currdBuV = out[3];
-        int currAntCap = out[4];
-        
+    if (sendDeviceCommand(RequestSi4711TuneStatus, out) && out.size() > 4) {
+        frequency = out[1] << 8 | out[2];
+        power = out[3];
+        antCap = out[4];
+        return true;
+    }
+    return false;
+}
+std::string VASTFMT::getTuneStatus() {
+    int currFreq, currdBuV, currAntCap;
+    if (readTuneStatus(currFreq, currdBuV, currAntCap)) {
         float f = currFreq / 100.0f;
         float cap = ((float)currAntCap) * 0.25f;
         
@@ -1,13 +1,29 @@
 #ifndef __VASTFMT__
 #define __VASTFMT__
 
+#include <functional>
+#include <time.h>
+
 #include "Si4713.h"
 
 struct hid_device_;
 
 class VASTFMT : public Si4713 {
 public:
-    VASTFMT();
+    // LibUSB keeps IN transfers queued from a read thread, Synchronous
+    // reads each reply with a blocking transfer on the calling thread,
+    // HIDRaw talks to the kernel HID driver instead of detaching it
+    // (Linux only)
+    enum class Backend {
+        LibUSB,
+        Synchronous,
+        HIDRaw
+    };
+    // Without fallback isOk() is false if the requested backend can't be
+    // opened, instead of using the libusb read thread
+    VASTFMT(Backend backend = Backend::LibUSB, bool fallback = true);
+    // what was actually opened
+    Backend getBackend() const { return backend; }
     virtual ~VASTFMT();
     
     
@@ -18,21 +34,49 @@ public:
     virtual void reset() override;
     virtual std::string getASQ() override;
     virtual std::string getTuneStatus() override;
+    virtual std::string getStats() override;
     
     
     void enableAudio();
     void disableAudio();
+
+    // How many property sets/RDS loads in a batch may be outstanding
+    // before their replies are read, 1 sends them one at a time.  Always
+    // 1 with the Synchronous backend, nothing reads ahead to hold replies.
+    void setPipelineWindow(int w);
+
+    // interrupt IN transfers kept queued for devices opened afterwards
+    static void setInputTransfers(int count);
+
+    // fn(true) when a VAST-FMT is plugged in, fn(false) when one is
+    // removed, called on a hidapi thread.  false if the system can't
+    // report hotplug events.
+    static bool watchHotplug(const std::function<void(bool)> &fn);
+    static void unwatchHotplug();
 protected:
     virtual bool sendSi4711Command(uint8_t cmd, const std::vector<uint8_t> &data, std::vector<uint8_t> &out, bool ignoreFailures = false) override;
-    virtual bool setProperty(uint16_t prop, uint16_t val) override;
+    virtual bool writeProperty(uint16_t prop, uint16_t val) override;
 
-    bool getProperty(uint16_t prop, uint16_t &val);
+    virtual bool getProperty(uint16_t prop, uint16_t &val) override;
+    virtual bool readTuneStatus(int &frequency, int &power, int &antCap) override;
     bool sendDeviceCommand(uint8_t cmd, bool ignoreFailures = false);
     bool sendDeviceCommand(uint8_t cmd, std::vector<uint8_t> &dataOut, bool ignoreFailures = false);
+    virtual bool sendBatch(Batch &batch) override;
 
     
 private:
+    int transact(unsigned char *bufOut, unsigned char *bufIn, int inLen, int timeoutMs);
+    void drainReports();
+    struct timespec replyDeadline(int timeoutMs);
+
     hid_device_ *phd = nullptr;
+    Backend backend = Backend::LibUSB;
+    bool synchronous = false;
+    uint64_t staleReports = 0;
+    uint64_t mismatchedReplies = 0;
+    uint64_t timeouts = 0;
+    int pipelineWindow = 1;
+    uint64_t pipelined = 0;
 };
 
 
@@ -113,6 +113,7 @@ struct hid_device_ {
 	uint8_t *input_report_buf;
 	CFIndex max_input_report_len;
 	struct input_report *input_reports;
+	unsigned long input_report_overflows;
 
 	pthread_t thread;
 	pthread_mutex_t mutex; /* Protects input_reports */
@@ -590,6 +591,7 @@ static void hid_report_callback(void *context, IOReturn result, void *sender,
 		   anything from the device. */
 		if (num_queued > 30) {
 			return_data(dev, NULL, 0);
+			dev->input_report_overflows++;
 		}
 	}
 
@@ -826,10 +828,24 @@ static int cond_wait(const hid_device *dev, pthread_cond_t *cond, pthread_mutex_
 	return 0;
 }
 
+/* abstime is on CLOCK_MONOTONIC. Darwin condition variables only
+   take wall clock deadlines so wait relative to the remaining time
+   instead, that way a clock step can't stretch or cut the wait. */
 static int cond_timedwait(const hid_device *dev, pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime)
 {
 	while (!dev->input_reports) {
-		int res = pthread_cond_timedwait(cond, mutex, abstime);
+		struct timespec now, rel;
+		int res;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		rel.tv_sec = abstime->tv_sec - now.tv_sec;
+		rel.tv_nsec = abstime->tv_nsec - now.tv_nsec;
+		if (rel.tv_nsec < 0) {
+			rel.tv_sec--;
+			rel.tv_nsec += 1000000000L;
+		}
+		if (rel.tv_sec < 0)
+			return ETIMEDOUT;
+		res = pthread_cond_timedwait_relative_np(cond, mutex, &rel);
 		if (res != 0)
 			return res;
 
@@ -847,7 +863,9 @@ static int cond_timedwait(const hid_device *dev, pthread_cond_t *cond, pthread_m
 
 }
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+/* Wait forever if blocking, else until the CLOCK_MONOTONIC deadline or
+   not at all if deadline is NULL. */
+static int read_report(hid_device *dev, unsigned char *data, size_t length, int blocking, const struct timespec *deadline)
 {
 	int bytes_read = -1;
 
@@ -877,7 +895,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 
 	/* There is no data. Go to sleep and wait for data. */
 
-	if (milliseconds == -1) {
+	if (blocking) {
 		/* Blocking */
 		int res;
 		res = cond_wait(dev, &dev->condition, &dev->mutex);
@@ -888,21 +906,10 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 			bytes_read = -1;
 		}
 	}
-	else if (milliseconds > 0) {
+	else if (deadline) {
 		/* Non-blocking, but called with timeout. */
 		int res;
-		struct timespec ts;
-		struct timeval tv;
-		gettimeofday(&tv, NULL);
-		TIMEVAL_TO_TIMESPEC(&tv, &ts);
-		ts.tv_sec += milliseconds / 1000;
-		ts.tv_nsec += (milliseconds % 1000) * 1000000;
-		if (ts.tv_nsec >= 1000000000L) {
-			ts.tv_sec++;
-			ts.tv_nsec -= 1000000000L;
-		}
-
-		res = cond_timedwait(dev, &dev->condition, &dev->mutex, &ts);
+		res = cond_timedwait(dev, &dev->condition, &dev->mutex, deadline);
 		if (res == 0)
 			bytes_read = return_data(dev, data, length);
 		else if (res == ETIMEDOUT)
@@ -921,11 +928,70 @@ ret:
 	return bytes_read;
 }
 
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	struct timespec ts;
+
+	if (milliseconds <= 0)
+		return read_report(dev, data, length, milliseconds == -1, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += milliseconds / 1000;
+	ts.tv_nsec += (milliseconds % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	return read_report(dev, data, length, 0, &ts);
+}
+
+int HID_API_EXPORT hid_read_deadline(hid_device *dev, unsigned char *data, size_t length, const struct timespec *deadline)
+{
+	return read_report(dev, data, length, 0, deadline);
+}
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
 }
 
+hid_device * HID_API_EXPORT hid_open_hidraw(unsigned short vendor_id, unsigned short product_id)
+{
+	/* Linux only. */
+	return NULL;
+}
+
+int HID_API_EXPORT hid_hotplug_register(unsigned short vendor_id, unsigned short product_id, hid_hotplug_callback callback, void *user_data)
+{
+	/* Not implemented, devices are only found by hid_enumerate(). */
+	return -1;
+}
+
+void HID_API_EXPORT hid_hotplug_deregister(void)
+{
+}
+
+int HID_API_EXPORT hid_set_synchronous(int synchronous)
+{
+	/* Reports always arrive through the run loop thread. */
+	return -1;
+}
+
+int HID_API_EXPORT hid_set_input_transfers(int count)
+{
+	/* IOKit manages the input transfers itself. */
+	return 0;
+}
+
+unsigned long HID_API_EXPORT hid_get_overflow_count(hid_device *dev)
+{
+	unsigned long count;
+	pthread_mutex_lock(&dev->mutex);
+	count = dev->input_report_overflows;
+	pthread_mutex_unlock(&dev->mutex);
+	return count;
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	/* All Nonblocking operation is handled by the library. */
@@ -42,6 +42,12 @@
 #include <fcntl.h>
 #include <pthread.h>
 #include <wchar.h>
+#include <poll.h>
+#include <dirent.h>
+#include <limits.h>
+#ifdef __linux__
+#include <linux/hidraw.h>
+#endif
 
 /* GNU / LibUSB */
 #include <libusb.h>
@@ -134,11 +140,32 @@ libusb HIDAPI programs are encouraged to use the interface number
 instead to differentiate between interfaces on a composite HID device. */
 /*#define INVASIVE_GET_USAGE*/
 
-/* Linked List of input reports received from the device. */
+/* Ring of input reports received from the device. The slots are
+   allocated once in hid_open_path() so the read callback never has to
+   allocate. When it is full the oldest report is dropped so it doesn't
+   stall if the user never reads anything from the device. */
+#define INPUT_REPORT_SLOTS 32
+
+/* Number of interrupt IN transfers kept submitted per device. With more
+   than one the host controller always has a transfer queued while the
+   read thread is resubmitting the one that just completed. */
+#define MAX_INPUT_TRANSFERS 8
+static int num_input_transfers = 2;
+
+/* Devices opened while this is set have no read thread, each read is a
+   libusb_interrupt_transfer() on the caller's thread. See
+   hid_set_synchronous(). */
+static int open_synchronous = 0;
+
+/* Largest interrupt IN packet read in synchronous mode (high speed). */
+#define MAX_INPUT_PACKET 1024
+
+/* How long a non-blocking read waits for a report in synchronous mode. */
+#define SYNC_POLL_MS 1
+
 struct input_report {
 	uint8_t *data;
 	size_t len;
-	struct input_report *next;
 };
 
 
@@ -154,6 +181,10 @@ struct hid_device_ {
 	/* The interface number of the HID */
 	int interface;
 
+	/* Whether the kernel driver was detached and needs reattaching
+	   on close, so hidraw works again without replugging. */
+	int detached_driver;
+
 	/* Indexes of Strings */
 	int manufacturer_index;
 	int product_index;
@@ -169,10 +200,28 @@ struct hid_device_ {
 	pthread_barrier_t barrier; /* Ensures correct startup sequence */
 	int shutdown_thread;
 	int cancelled;
-	struct libusb_transfer *transfer;
-
-	/* List of received input reports. */
-	struct input_report *input_reports;
+	struct libusb_transfer *transfers[MAX_INPUT_TRANSFERS];
+	unsigned char *transfer_buffer;
+	int num_transfers;
+	int active_transfers; /* only touched from read_callback(), libusb runs
+	                         those one at a time in whichever thread is
+	                         handling events */
+
+	/* Ring of received input reports, protected by mutex. */
+	struct input_report input_reports[INPUT_REPORT_SLOTS];
+	uint8_t *input_report_buffer;
+	size_t input_report_size;
+	int input_report_head;
+	int input_report_count;
+	unsigned long input_report_overflows;
+
+	/* No read thread, reads go straight to libusb. */
+	int synchronous;
+
+	/* Set when opened through hid_open_hidraw(). The kernel HID driver
+	   does the transfers and queueing, none of the libusb members or
+	   the read thread are used. */
+	int hidraw_fd;
 };
 
 static libusb_context *usb_context = NULL;
@@ -183,10 +232,17 @@ static int return_data(hid_device *dev, unsigned char *data, size_t length);
 static hid_device *new_hid_device(void)
 {
 	hid_device *dev = calloc(1, sizeof(hid_device));
+	pthread_condattr_t attr;
 	dev->blocking = 1;
+	dev->hidraw_fd = -1;
 
 	pthread_mutex_init(&dev->mutex, NULL);
-	pthread_cond_init(&dev->condition, NULL);
+	/* Timed reads must not jump when the wall clock is stepped (NTP
+	   on a board without an RTC), so wait on the monotonic clock. */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&dev->condition, &attr);
+	pthread_condattr_destroy(&attr);
 	pthread_barrier_init(&dev->barrier, NULL, 2);
 
 	return dev;
@@ -194,6 +250,8 @@ static hid_device *new_hid_device(void)
 
 static void free_hid_device(hid_device *dev)
 {
+	free(dev->input_report_buffer);
+
 	/* Clean up the thread objects */
 	pthread_barrier_destroy(&dev->barrier);
 	pthread_cond_destroy(&dev->condition);
@@ -508,8 +566,77 @@ int HID_API_EXPORT hid_init(void)
 	return 0;
 }
 
+int HID_API_EXPORT hid_set_input_transfers(int count)
+{
+	if (count < 1 || count > MAX_INPUT_TRANSFERS)
+		return -1;
+	num_input_transfers = count;
+	return 0;
+}
+
+int HID_API_EXPORT hid_set_synchronous(int synchronous)
+{
+	open_synchronous = synchronous;
+	return 0;
+}
+
+/* One hotplug registration, its events are dispatched from a thread
+   blocked in libusb_handle_events so nothing polls the bus. */
+static libusb_hotplug_callback_handle hotplug_handle;
+static hid_hotplug_callback hotplug_callback = NULL;
+static void *hotplug_user_data = NULL;
+static pthread_t hotplug_thread;
+static int hotplug_shutdown = 0;
+
+static int hotplug_event(libusb_context *ctx, libusb_device *device, libusb_hotplug_event event, void *user_data)
+{
+	hotplug_callback(event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, hotplug_user_data);
+	return 0; /* stay registered */
+}
+
+static void *hotplug_thread_main(void *param)
+{
+	while (!hotplug_shutdown)
+		libusb_handle_events_completed(usb_context, &hotplug_shutdown);
+	return NULL;
+}
+
+int HID_API_EXPORT hid_hotplug_register(unsigned short vendor_id, unsigned short product_id, hid_hotplug_callback callback, void *user_data)
+{
+	if (hotplug_callback || hid_init() < 0)
+		return -1;
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+		return -1;
+
+	hotplug_callback = callback;
+	hotplug_user_data = user_data;
+	if (libusb_hotplug_register_callback(usb_context,
+			LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+			LIBUSB_HOTPLUG_NO_FLAGS, vendor_id, product_id, LIBUSB_HOTPLUG_MATCH_ANY,
+			hotplug_event, NULL, &hotplug_handle) != LIBUSB_SUCCESS) {
+		hotplug_callback = NULL;
+		return -1;
+	}
+	hotplug_shutdown = 0;
+	pthread_create(&hotplug_thread, NULL, hotplug_thread_main, NULL);
+	return 0;
+}
+
+void HID_API_EXPORT hid_hotplug_deregister(void)
+{
+	if (!hotplug_callback)
+		return;
+	hotplug_shutdown = 1;
+	/* Deregistering wakes the event handler so the thread sees the flag. */
+	libusb_hotplug_deregister_callback(usb_context, hotplug_handle);
+	pthread_join(hotplug_thread, NULL);
+	hotplug_callback = NULL;
+}
+
 int HID_API_EXPORT hid_exit(void)
 {
+	hid_hotplug_deregister();
+
 	if (usb_context) {
 		libusb_exit(usb_context);
 		usb_context = NULL;
@@ -729,6 +856,60 @@ hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const
 	return handle;
 }
 
+static int alloc_input_reports(hid_device *dev)
+{
+	int i;
+	dev->input_report_size = dev->input_ep_max_packet_size;
+	dev->input_report_buffer = malloc(INPUT_REPORT_SLOTS * dev->input_report_size);
+	if (!dev->input_report_buffer)
+		return -1;
+	for (i = 0; i < INPUT_REPORT_SLOTS; i++) {
+		dev->input_reports[i].data = dev->input_report_buffer + i * dev->input_report_size;
+		dev->input_reports[i].len = 0;
+	}
+	return 0;
+}
+
+/* Copy a report into the next free slot.
+   This should be called with dev->mutex locked. */
+static void queue_report(hid_device *dev, const uint8_t *data, size_t length)
+{
+	struct input_report *rpt;
+
+	if (dev->input_report_count == INPUT_REPORT_SLOTS) {
+		/* Full, drop the oldest. */
+		dev->input_report_head = (dev->input_report_head + 1) % INPUT_REPORT_SLOTS;
+		dev->input_report_count--;
+		dev->input_report_overflows++;
+	}
+	rpt = &dev->input_reports[(dev->input_report_head + dev->input_report_count) % INPUT_REPORT_SLOTS];
+	rpt->len = (length < dev->input_report_size)? length: dev->input_report_size;
+	memcpy(rpt->data, data, rpt->len);
+	dev->input_report_count++;
+}
+
+/* A transfer has finished for good and won't be resubmitted. Once the
+   last one is done the read thread can exit. */
+static void transfer_done(hid_device *dev)
+{
+	dev->active_transfers--;
+	if (dev->active_transfers <= 0)
+		dev->cancelled = 1;
+}
+
+/* Stop the transfers for good. shutdown_thread is set under the mutex
+   read_callback() resubmits under, so a transfer that completes during
+   the cancel pass is never resubmitted behind it. */
+static void cancel_transfers(hid_device *dev)
+{
+	int i;
+	pthread_mutex_lock(&dev->mutex);
+	dev->shutdown_thread = 1;
+	for (i = 0; i < dev->num_transfers; i++)
+		libusb_cancel_transfer(dev->transfers[i]);
+	pthread_mutex_unlock(&dev->mutex);
+}
+
 static void read_callback(struct libusb_transfer *transfer)
 {
 	hid_device *dev = transfer->user_data;
@@ -736,47 +917,22 @@ static void read_callback(struct libusb_transfer *transfer)
 
 	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
 
-		struct input_report *rpt = malloc(sizeof(*rpt));
-		rpt->data = malloc(transfer->actual_length);
-		memcpy(rpt->data, transfer->buffer, transfer->actual_length);
-		rpt->len = transfer->actual_length;
-		rpt->next = NULL;
-
 		pthread_mutex_lock(&dev->mutex);
-
-		/* Attach the new report object to the end of the list. */
-		if (dev->input_reports == NULL) {
-			/* The list is empty. Put it at the root. */
-			dev->input_reports = rpt;
+		queue_report(dev, transfer->buffer, transfer->actual_length);
+		if (dev->input_report_count == 1) {
+			/* The ring was empty, a reader may be waiting. */
 			pthread_cond_signal(&dev->condition);
 		}
-		else {
-			/* Find the end of the list and attach. */
-			struct input_report *cur = dev->input_reports;
-			int num_queued = 0;
-			while (cur->next != NULL) {
-				cur = cur->next;
-				num_queued++;
-			}
-			cur->next = rpt;
-
-			/* Pop one off if we've reached 30 in the queue. This
-			   way we don't grow forever if the user never reads
-			   anything from the device. */
-			if (num_queued > 30) {
-				return_data(dev, NULL, 0);
-			}
-		}
 		pthread_mutex_unlock(&dev->mutex);
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
 		dev->shutdown_thread = 1;
-		dev->cancelled = 1;
+		transfer_done(dev);
 		return;
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
 		dev->shutdown_thread = 1;
-		dev->cancelled = 1;
+		transfer_done(dev);
 		return;
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
@@ -786,12 +942,19 @@ static void read_callback(struct libusb_transfer *transfer)
 		LOG("Unknown transfer code: %d\n", transfer->status);
 	}
 
-	/* Re-submit the transfer object. */
+	/* Re-submit the transfer object, unless it is being shut down. */
+	pthread_mutex_lock(&dev->mutex);
+	if (dev->shutdown_thread) {
+		pthread_mutex_unlock(&dev->mutex);
+		transfer_done(dev);
+		return;
+	}
 	res = libusb_submit_transfer(transfer);
+	pthread_mutex_unlock(&dev->mutex);
 	if (res != 0) {
 		LOG("Unable to submit URB. libusb error code: %d\n", res);
 		dev->shutdown_thread = 1;
-		dev->cancelled = 1;
+		transfer_done(dev);
 	}
 }
 
@@ -799,24 +962,35 @@ static void read_callback(struct libusb_transfer *transfer)
 static void *read_thread(void *param)
 {
 	hid_device *dev = param;
-	unsigned char *buf;
 	const size_t length = dev->input_ep_max_packet_size;
+	int i;
+
+	/* Set up the transfer objects, all sharing one buffer block. */
+	dev->num_transfers = num_input_transfers;
+	dev->transfer_buffer = malloc(length * dev->num_transfers);
+	for (i = 0; i < dev->num_transfers; i++) {
+		dev->transfers[i] = libusb_alloc_transfer(0);
+		libusb_fill_interrupt_transfer(dev->transfers[i],
+			dev->device_handle,
+			dev->input_endpoint,
+			dev->transfer_buffer + i * length,
+			length,
+			read_callback,
+			dev,
+			5000/*timeout*/);
+	}
 
-	/* Set up the transfer object. */
-	buf = malloc(length);
-	dev->transfer = libusb_alloc_transfer(0);
-	libusb_fill_interrupt_transfer(dev->transfer,
-		dev->device_handle,
-		dev->input_endpoint,
-		buf,
-		length,
-		read_callback,
-		dev,
-		5000/*timeout*/);
-
-	/* Make the first submission. Further submissions are made
+	/* Make the first submissions. Further submissions are made
 	   from inside read_callback() */
-	libusb_submit_transfer(dev->transfer);
+	dev->active_transfers = 0;
+	for (i = 0; i < dev->num_transfers; i++) {
+		if (libusb_submit_transfer(dev->transfers[i]) == 0)
+			dev->active_transfers++;
+	}
+	if (dev->active_transfers == 0) {
+		dev->shutdown_thread = 1;
+		dev->cancelled = 1;
+	}
 
 	/* Notify the main thread that the read thread is up and running. */
 	pthread_barrier_wait(&dev->barrier);
@@ -839,9 +1013,9 @@ static void *read_thread(void *param)
 		}
 	}
 
-	/* Cancel any transfer that may be pending. This call will fail
+	/* Cancel any transfers that may be pending. This call will fail
 	   if no transfers are pending, but that's OK. */
-	libusb_cancel_transfer(dev->transfer);
+	cancel_transfers(dev);
 
 	while (!dev->cancelled)
 		libusb_handle_events_completed(usb_context, &dev->cancelled);
@@ -855,7 +1029,7 @@ static void *read_thread(void *param)
 	pthread_cond_broadcast(&dev->condition);
 	pthread_mutex_unlock(&dev->mutex);
 
-	/* The dev->transfer->buffer and dev->transfer objects are cleaned up
+	/* The dev->transfer_buffer and dev->transfers objects are cleaned up
 	   in hid_close(). They are not cleaned up here because this thread
 	   could end either due to a disconnect or due to a user
 	   call to hid_close(). In both cases the objects can be safely
@@ -921,6 +1095,7 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 								good_open = 0;
 								break;
 							}
+							dev->detached_driver = 1;
 						}
 #endif
 						res = libusb_claim_interface(dev->device_handle, intf_desc->bInterfaceNumber);
@@ -972,10 +1147,24 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 							}
 						}
 
-						pthread_create(&dev->thread, NULL, read_thread, dev);
+						if (open_synchronous) {
+							dev->synchronous = 1;
+						}
+						else if (alloc_input_reports(dev) < 0) {
+							LOG("can't allocate input report buffers\n");
+							free(dev_path);
+							libusb_release_interface(dev->device_handle, dev->interface);
+							libusb_close(dev->device_handle);
+							good_open = 0;
+							break;
+						}
+
+						if (!dev->synchronous) {
+							pthread_create(&dev->thread, NULL, read_thread, dev);
 
-						/* Wait here for the read thread to be initialized. */
-						pthread_barrier_wait(&dev->barrier);
+							/* Wait here for the read thread to be initialized. */
+							pthread_barrier_wait(&dev->barrier);
+						}
 
 					}
 					free(dev_path);
@@ -1000,12 +1189,100 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 }
 
 
+#ifdef __linux__
+/* The USB interface number of a hidraw node, from the name of the
+   interface directory above the HID device in sysfs ("1-1:1.2"). */
+static int hidraw_interface(const char *name)
+{
+	char link[PATH_MAX];
+	char real[PATH_MAX];
+	char *dot;
+
+	snprintf(link, sizeof(link), "/sys/class/hidraw/%s/device/..", name);
+	if (!realpath(link, real))
+		return -1;
+	dot = strrchr(real, '.');
+	if (!dot || !strchr(real, ':'))
+		return -1;
+	return atoi(dot + 1);
+}
+#endif
+
+hid_device * HID_API_EXPORT hid_open_hidraw(unsigned short vendor_id, unsigned short product_id)
+{
+#ifdef __linux__
+	hid_device *dev;
+	DIR *dir;
+	struct dirent *ent;
+	char best[64] = "";
+	int best_interface = INT_MAX;
+	char path[PATH_MAX];
+	int fd;
+
+	dir = opendir("/sys/class/hidraw");
+	if (!dir)
+		return NULL;
+	while ((ent = readdir(dir)) != NULL) {
+		char line[256];
+		FILE *f;
+		unsigned int bus, vid, pid;
+		int found = 0;
+
+		if (strncmp(ent->d_name, "hidraw", 6))
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/hidraw/%s/device/uevent", ent->d_name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		while (fgets(line, sizeof(line), f)) {
+			if (sscanf(line, "HID_ID=%x:%x:%x", &bus, &vid, &pid) == 3) {
+				found = vid == vendor_id && pid == product_id;
+				break;
+			}
+		}
+		fclose(f);
+
+		/* Same interface the libusb path would pick, the lowest one. */
+		if (found) {
+			int intf = hidraw_interface(ent->d_name);
+			/* -1 if the USB interface can't be resolved, skip it. */
+			if (intf >= 0 && intf < best_interface) {
+				best_interface = intf;
+				snprintf(best, sizeof(best), "%s", ent->d_name);
+			}
+		}
+	}
+	closedir(dir);
+	if (!best[0])
+		return NULL;
+
+	snprintf(path, sizeof(path), "/dev/%s", best);
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		LOG("can't open %s: %d\n", path, errno);
+		return NULL;
+	}
+	dev = new_hid_device();
+	dev->hidraw_fd = fd;
+	dev->interface = best_interface;
+	return dev;
+#else
+	return NULL;
+#endif
+}
+
 int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
 {
 	int res;
 	int report_number = data[0];
 	int skipped_report_id = 0;
 
+	if (dev->hidraw_fd >= 0) {
+		/* hidraw takes the report number as the first byte, 0 for
+		   devices without numbered reports, just like we do. */
+		return write(dev->hidraw_fd, data, length);
+	}
+
 	if (report_number == 0x0) {
 		data++;
 		length--;
@@ -1054,15 +1331,14 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
    This should be called with dev->mutex locked. */
 static int return_data(hid_device *dev, unsigned char *data, size_t length)
 {
-	/* Copy the data out of the linked list item (rpt) into the
-	   return buffer (data), and delete the liked list item. */
-	struct input_report *rpt = dev->input_reports;
+	/* Copy the data out of the oldest slot (rpt) into the
+	   return buffer (data), and free the slot. */
+	struct input_report *rpt = &dev->input_reports[dev->input_report_head];
 	size_t len = (length < rpt->len)? length: rpt->len;
 	if (len > 0)
 		memcpy(data, rpt->data, len);
-	dev->input_reports = rpt->next;
-	free(rpt->data);
-	free(rpt);
+	dev->input_report_head = (dev->input_report_head + 1) % INPUT_REPORT_SLOTS;
+	dev->input_report_count--;
 	return len;
 }
 
@@ -1073,10 +1349,93 @@ static void cleanup_mutex(void *param)
 }
 
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+/* Read straight from the hidraw node, the kernel queues the reports. */
+static int hidraw_read(hid_device *dev, unsigned char *data, size_t length, int blocking, const struct timespec *deadline)
+{
+	struct pollfd pfd;
+	int timeout = 0;
+	int res;
+
+	if (blocking) {
+		timeout = -1;
+	}
+	else if (deadline) {
+		struct timespec now;
+		long long ms;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (deadline->tv_sec - now.tv_sec) * 1000LL + (deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+		timeout = ms > 0 ? (int)ms : 0;
+	}
+
+	pfd.fd = dev->hidraw_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	res = poll(&pfd, 1, timeout);
+	if (res == 0)
+		return 0;
+	if (res < 0) {
+		if (errno == EINTR)
+			return 0;
+		return -1;
+	}
+	if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+		return -1;
+
+	res = read(dev->hidraw_fd, data, length);
+	if (res < 0 && (errno == EAGAIN || errno == EINPROGRESS))
+		return 0;
+	return res;
+}
+
+/* Synchronous mode: one interrupt IN transfer on the caller's thread.
+   Nothing is queued between reads, so a non-blocking read (or one whose
+   deadline has passed) polls the endpoint for SYNC_POLL_MS instead; a
+   timeout of 0 would mean no timeout to libusb. */
+static int sync_read(hid_device *dev, unsigned char *data, size_t length, int blocking, const struct timespec *deadline)
+{
+	unsigned char buf[MAX_INPUT_PACKET];
+	unsigned int timeout = 0; /* 0 is no timeout for libusb */
+	int transferred = 0;
+	int size = dev->input_ep_max_packet_size;
+	int res;
+
+	if (!blocking) {
+		timeout = SYNC_POLL_MS;
+		if (deadline) {
+			struct timespec now;
+			long long ms;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			ms = (deadline->tv_sec - now.tv_sec) * 1000LL + (deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+			if (ms > SYNC_POLL_MS)
+				timeout = (unsigned int)ms;
+		}
+	}
+	if (size <= 0 || size > MAX_INPUT_PACKET)
+		size = MAX_INPUT_PACKET;
+
+	/* Read a whole packet so a short buffer can't overflow the transfer. */
+	res = libusb_interrupt_transfer(dev->device_handle, dev->input_endpoint, buf, size, &transferred, timeout);
+	if (res == LIBUSB_ERROR_TIMEOUT)
+		return 0;
+	if (res < 0)
+		return -1;
+	if ((size_t)transferred > length)
+		transferred = length;
+	memcpy(data, buf, transferred);
+	return transferred;
+}
+
+/* Wait forever if blocking, else until the CLOCK_MONOTONIC deadline or
+   not at all if deadline is NULL. */
+static int read_report(hid_device *dev, unsigned char *data, size_t length, int blocking, const struct timespec *deadline)
 {
 	int bytes_read = -1;
 
+	if (dev->hidraw_fd >= 0)
+		return hidraw_read(dev, data, length, blocking, deadline);
+	if (dev->synchronous)
+		return sync_read(dev, data, length, blocking, deadline);
+
 #if 0
 	int transferred;
 	int res = libusb_interrupt_transfer(dev->device_handle, dev->input_endpoint, data, length, &transferred, 5000);
@@ -1088,7 +1447,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	pthread_cleanup_push(&cleanup_mutex, dev);
 
 	/* There's an input report queued up. Return it. */
-	if (dev->input_reports) {
+	if (dev->input_report_count) {
 		/* Return the first one */
 		bytes_read = return_data(dev, data, length);
 		goto ret;
@@ -1101,31 +1460,23 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 		goto ret;
 	}
 
-	if (milliseconds == -1) {
+	if (blocking) {
 		/* Blocking */
-		while (!dev->input_reports && !dev->shutdown_thread) {
+		while (!dev->input_report_count && !dev->shutdown_thread) {
 			pthread_cond_wait(&dev->condition, &dev->mutex);
 		}
-		if (dev->input_reports) {
+		if (dev->input_report_count) {
 			bytes_read = return_data(dev, data, length);
 		}
 	}
-	else if (milliseconds > 0) {
+	else if (deadline) {
 		/* Non-blocking, but called with timeout. */
 		int res;
-		struct timespec ts;
-		clock_gettime(CLOCK_REALTIME, &ts);
-		ts.tv_sec += milliseconds / 1000;
-		ts.tv_nsec += (milliseconds % 1000) * 1000000;
-		if (ts.tv_nsec >= 1000000000L) {
-			ts.tv_sec++;
-			ts.tv_nsec -= 1000000000L;
-		}
 
-		while (!dev->input_reports && !dev->shutdown_thread) {
-			res = pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts);
+		while (!dev->input_report_count && !dev->shutdown_thread) {
+			res = pthread_cond_timedwait(&dev->condition, &dev->mutex, deadline);
 			if (res == 0) {
-				if (dev->input_reports) {
+				if (dev->input_report_count) {
 					bytes_read = return_data(dev, data, length);
 					break;
 				}
@@ -1158,11 +1509,46 @@ ret:
 	return bytes_read;
 }
 
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	struct timespec ts;
+
+	if (milliseconds <= 0)
+		return read_report(dev, data, length, milliseconds == -1, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += milliseconds / 1000;
+	ts.tv_nsec += (milliseconds % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	return read_report(dev, data, length, 0, &ts);
+}
+
+int HID_API_EXPORT hid_read_deadline(hid_device *dev, unsigned char *data, size_t length, const struct timespec *deadline)
+{
+	return read_report(dev, data, length, 0, deadline);
+}
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, dev->blocking ? -1 : 0);
 }
 
+unsigned long HID_API_EXPORT hid_get_overflow_count(hid_device *dev)
+{
+	unsigned long count;
+	if (dev->hidraw_fd >= 0) {
+		/* The kernel doesn't tell. */
+		return 0;
+	}
+	pthread_mutex_lock(&dev->mutex);
+	count = dev->input_report_overflows;
+	pthread_mutex_unlock(&dev->mutex);
+	return count;
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	dev->blocking = !nonblock;
@@ -1177,6 +1563,11 @@ int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char
 	int skipped_report_id = 0;
 	int report_number = data[0];
 
+#ifdef __linux__
+	if (dev->hidraw_fd >= 0)
+		return ioctl(dev->hidraw_fd, HIDIOCSFEATURE(length), data);
+#endif
+
 	if (report_number == 0x0) {
 		data++;
 		length--;
@@ -1207,6 +1598,11 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 	int skipped_report_id = 0;
 	int report_number = data[0];
 
+#ifdef __linux__
+	if (dev->hidraw_fd >= 0)
+		return ioctl(dev->hidraw_fd, HIDIOCGFEATURE(length), data);
+#endif
+
 	if (report_number == 0x0) {
 		/* Offset the return buffer by 1, so that the report ID
 		   will remain in byte 0. */
@@ -1234,33 +1630,42 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 
 void HID_API_EXPORT hid_close(hid_device *dev)
 {
+	int i;
+
 	if (!dev)
 		return;
 
-	/* Cause read_thread() to stop. */
-	dev->shutdown_thread = 1;
-	libusb_cancel_transfer(dev->transfer);
+	if (dev->hidraw_fd >= 0) {
+		close(dev->hidraw_fd);
+		free_hid_device(dev);
+		return;
+	}
+
+	if (!dev->synchronous) {
+		/* Cause read_thread() to stop. */
+		cancel_transfers(dev);
 
-	/* Wait for read_thread() to end. */
-	pthread_join(dev->thread, NULL);
+		/* Wait for read_thread() to end. */
+		pthread_join(dev->thread, NULL);
 
-	/* Clean up the Transfer objects allocated in read_thread(). */
-	free(dev->transfer->buffer);
-	libusb_free_transfer(dev->transfer);
+		/* Clean up the Transfer objects allocated in read_thread(). */
+		for (i = 0; i < dev->num_transfers; i++)
+			libusb_free_transfer(dev->transfers[i]);
+		free(dev->transfer_buffer);
+	}
 
 	/* release the interface */
 	libusb_release_interface(dev->device_handle, dev->interface);
 
+#ifdef DETACH_KERNEL_DRIVER
+	/* Hand the interface back to the kernel */
+	if (dev->detached_driver)
+		libusb_attach_kernel_driver(dev->device_handle, dev->interface);
+#endif
+
 	/* Close the handle */
 	libusb_close(dev->device_handle);
 
-	/* Clear out the queue of received reports. */
-	pthread_mutex_lock(&dev->mutex);
-	while (dev->input_reports) {
-		return_data(dev, NULL, 0);
-	}
-	pthread_mutex_unlock(&dev->mutex);
-
 	free_hid_device(dev);
 }
 
@@ -1284,6 +1689,9 @@ int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index
 {
 	wchar_t *str;
 
+	if (dev->hidraw_fd >= 0)
+		return -1;
+
 	str = get_usb_string(dev->device_handle, string_index);
 	if (str) {
 		wcsncpy(string, str, maxlen);
@@ -27,6 +27,7 @@
 #ifndef HIDAPI_H__
 #define HIDAPI_H__
 
+#include <time.h>
 #include <wchar.h>
 
 #ifdef _WIN32
@@ -108,6 +109,70 @@ extern "C" {
 		*/
 		int HID_API_EXPORT HID_API_CALL hid_exit(void);
 
+		/** @brief Set how many interrupt IN transfers are kept
+			submitted for each device opened afterwards.
+
+			More than one means a report arriving while the previous
+			transfer is being resubmitted doesn't have to wait for the
+			next polling interval.  Not all backends use this.
+
+			@ingroup API
+			@param count Number of transfers, 1 to 8.  The default is 2.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_input_transfers(int count);
+
+		/** @brief Open devices without a read thread.
+
+			For devices opened afterwards each hid_read_timeout() or
+			hid_read_deadline() does one interrupt IN transfer on the
+			calling thread.  No reports are queued between reads so this
+			only suits strict request/reply protocols, and a
+			non-blocking read waits up to 1ms for a report the
+			device already has pending.
+
+			@ingroup API
+			@param synchronous 1 to enable, 0 to go back to the read thread.
+
+			@returns
+				This function returns 0 on success and -1 if the backend
+				doesn't support it.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_synchronous(int synchronous);
+
+		/** Called with 1 when a matching device arrives and 0 when one
+			is removed. */
+		typedef void (HID_API_CALL *hid_hotplug_callback)(int arrived, void *user_data);
+
+		/** @brief Get told when a device is plugged in or removed.
+
+			The callback runs on a hidapi thread that only wakes for
+			events, it must not open or close devices itself.  Devices
+			already present are not reported.  Only one registration
+			can be active.
+
+			@ingroup API
+			@param vendor_id The Vendor ID (VID) to watch.
+			@param product_id The Product ID (PID) to watch.
+			@param callback Function to call for each arrival/removal.
+			@param user_data Passed through to the callback.
+
+			@returns
+				This function returns 0 on success and -1 if hotplug
+				isn't supported or a callback is already registered.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hotplug_register(unsigned short vendor_id, unsigned short product_id, hid_hotplug_callback callback, void *user_data);
+
+		/** @brief Remove the callback registered with hid_hotplug_register().
+
+			Waits for a callback that is running to return.
+
+			@ingroup API
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_hotplug_deregister(void);
+
 		/** @brief Enumerate the HID Devices.
 
 			This function returns a linked list of all the HID devices
@@ -174,6 +239,23 @@ extern "C" {
 		*/
 		HID_API_EXPORT hid_device * HID_API_CALL hid_open_path(const char *path);
 
+		/** @brief Open a HID device through the Linux hidraw driver.
+
+			Reads and writes go straight to /dev/hidrawN, the kernel
+			HID driver stays attached and no read thread is started.
+			If the device has several HID interfaces the lowest
+			numbered one is used, as hid_enumerate() lists it first.
+
+			@ingroup API
+			@param vendor_id The Vendor ID (VID) of the device to open.
+			@param product_id The Product ID (PID) of the device to open.
+
+			@returns
+				This function returns a pointer to a #hid_device object on
+				success or NULL on failure or where hidraw isn't available.
+		*/
+		HID_API_EXPORT hid_device * HID_API_CALL hid_open_hidraw(unsigned short vendor_id, unsigned short product_id);
+
 		/** @brief Write an Output report to a HID device.
 
 			The first byte of @p data[] must contain the Report ID. For
@@ -223,6 +305,28 @@ extern "C" {
 		*/
 		int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds);
 
+		/** @brief Read an Input report from a HID device, waiting
+			until an absolute deadline.
+
+			Like hid_read_timeout() but several reads can share one
+			time budget.  The timeout of hid_read_timeout() is measured
+			on the same clock so neither is affected by changes to the
+			wall clock.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param data A buffer to put the read data into.
+			@param length The number of bytes to read.
+			@param deadline CLOCK_MONOTONIC time to give up at.  A
+				deadline in the past makes this a non-blocking read.
+
+			@returns
+				This function returns the actual number of bytes read and
+				-1 on error. If no packet was available to be read before
+				the deadline, this function returns 0.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_deadline(hid_device *dev, unsigned char *data, size_t length, const struct timespec *deadline);
+
 		/** @brief Read an Input report from a HID device.
 
 			Input reports are returned
@@ -243,6 +347,17 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_read(hid_device *device, unsigned char *data, size_t length);
 
+		/** @brief Get the number of input reports dropped because
+			they were not read before the report queue filled up.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+
+			@returns
+				The number of reports dropped since the device was opened.
+		*/
+		unsigned long HID_API_EXPORT HID_API_CALL hid_get_overflow_count(hid_device *device);
+
 		/** @brief Set the device handle to be non-blocking.
 
 			In non-blocking mode calls to hid_read() will return